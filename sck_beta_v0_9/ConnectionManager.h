@@ -0,0 +1,77 @@
+/*
+
+  ConnectionManager.h
+  Decides when the Wi-Fi may be powered to try a connection.
+
+  - Exponential backoff (with random jitter) after each failed connection.
+  - Radio time budget per hour.
+  - Circuit breaker: after LINK_BREAKER_FAILURES failures in a row only one test
+    connection is allowed every LINK_BREAKER_COOLDOWN seconds.
+
+*/
+
+#ifndef SmartCitizen_ConnectionManager_h
+#define SmartCitizen_ConnectionManager_h
+
+#include <Arduino.h>
+#include "Constants.h"
+
+class ConnectionManager {
+  public:
+
+    void setup(uint32_t budget_)
+    {
+      budget = budget_ * 1000;
+    }
+
+    boolean allow()
+    {
+      unsigned long now = millis();
+      if ((now - windowStart) >= hour) {
+        windowStart = now;
+        used = 0;
+      }
+      if ((budget > 0) && (used >= budget)) return false;
+      if (failures == 0) return true;
+      return ((long)(now - retryAt) >= 0);
+    }
+
+    void start()
+    {
+      startedAt = millis();
+    }
+
+    void stop(boolean ok)
+    {
+      unsigned long now = millis();
+      used += now - startedAt;
+      total += now - startedAt;
+      if (ok) {
+        failures = 0;
+        return;
+      }
+      if (failures < 255) failures++;
+      unsigned long wait;
+      if (isOpen()) wait = LINK_BREAKER_COOLDOWN;
+      else {
+        wait = (unsigned long)LINK_BACKOFF_MIN << (failures - 1);
+        if (wait > LINK_BACKOFF_MAX) wait = LINK_BACKOFF_MAX;
+      }
+      wait = wait * 1000;
+      retryAt = now + random(wait / 2, wait);
+    }
+
+    boolean isOpen()
+    {
+      return (failures >= LINK_BREAKER_FAILURES);
+    }
+
+    uint32_t budget;        // ms of radio per hour, 0 = unlimited
+    uint32_t used;          // ms of radio in the current hour
+    uint32_t total;         // ms of radio since boot
+    unsigned long windowStart;
+    unsigned long startedAt;
+    unsigned long retryAt;
+    byte failures;
+};
+#endif
@@ -8,10 +8,15 @@
 #define __CONSTANTS_H__
 
 
-#define decouplerComp     false   //Only for version Goteo 1.0
+#define decouplerComp     false   //Only for version Goteo 1.0, replaces the thermal model
 
 #define USBEnabled        true
 
+#define NOISE_A_WEIGHTING false   //Only for a microphone wired to S4 without the envelope detector
+#define NOISE_OCTAVES     false   //Octave band levels of the microphone (extra values posted)
+#define VIBRATION         false   //Vibration, tilt and activity from the ADXL345, SCK 1.1 only (extra values posted)
+#define INTERVAL_STATS    false   //Min/max/mean/stddev of the cheap channels per upload interval (extra values posted)
+
 /*
     DEBUGGING
 */
@@ -110,8 +115,35 @@ static char* antennaExt[NETWORKS]  = {
 #define MAX_TIME_UPDATE      3600   //Max time between updates (one hour)
 #define DEFAULT_MIN_UPDATES  1      //Minimum number of updates before posting
 #define POST_MAX             20     //Max number of postings at a time
+#define DEFAULT_UPLOAD_BUDGET 60    //Seconds an upload cycle may spend flushing the memory (0 = no limit)
+#define DEFAULT_UPLOAD_BYTES  0     //Bytes an upload cycle may send (0 = no limit)
+#define UPLOAD_OLDEST        0      //Flush the memory oldest readings first
+#define UPLOAD_NEWEST        1      //Flush the memory newest readings first
 #define DEFAULT_MODE_SENSOR  NORMAL     //Type sensors capture (OFFLINE, NOWIFI, NORMAL, ECONOMIC)
 
+/*
+
+  CONNECTION MANAGER - Wi-Fi backoff, radio budget and circuit breaker
+
+*/
+
+#define LINK_BACKOFF_MIN      30     //Seconds to wait after the first failed connection (doubles on each failure)
+#define LINK_BACKOFF_MAX      960    //Seconds, longest backoff
+#define LINK_BREAKER_FAILURES 8      //Failed connections in a row that open the circuit breaker
+#define LINK_BREAKER_COOLDOWN 3600   //Seconds between test connections while the breaker is open
+#define DEFAULT_RADIO_BUDGET  300    //Seconds of radio time allowed per hour (0 = unlimited)
+#define MAX_RADIO_BUDGET      3600   //Seconds, the whole hour
+
+/*
+
+  EVENTS - Readings that bypass batching and are posted at once
+
+*/
+
+#define EVENT_CHANNELS       3      //Channels watched by the detectors (CO, NO2, NOISE)
+#define DEFAULT_EVENT_ZSCORE 50     //Tenths of sigma (5.0), 0 disables the z-score trigger
+#define MAX_EVENT_ZSCORE     1000
+
 /*
 
   i2c ADDRESSES
@@ -126,6 +158,24 @@ static char* antennaExt[NETWORKS]  = {
 #define bh1730             0x29    // Direction of the light sensor
 #define Temperature        0x40    // Direction of the sht21    
 #define ADXL               0x53    // ADXL345 device address
+#define ADXL_BW_RATE       0x2C    // ADXL345 registers
+#define ADXL_DATA          0x32
+#define ADXL_FIFO_CTL      0x38
+#define ADXL_FIFO_STATUS   0x39
+#define ADXL_RATE          0x0A    // 100Hz output data rate
+#define ADXL_STREAM        0x80    // FIFO_CTL stream mode, the oldest samples are dropped
+#define ADXL_FIFO_SIZE     32
+#define ADXL_HZ            100
+#define ADXL_MG_X10        156     // mg x10 per count, 10 bits over +-8g
+#define ADXL_THRESH_ACT    0x24
+#define ADXL_ACT_CTL       0x27
+#define ADXL_INT_ENABLE    0x2E
+#define ADXL_INT_SOURCE    0x30
+#define ADXL_ACTIVITY      0x10    // INT_ENABLE / INT_SOURCE activity bit
+#define ADXL_ACT_AC_XYZ    0xF0    // AC coupled activity on x, y and z
+#define ADXL_ACT_LEVEL     8       // 62.5mg per count, 0.5g
+#define ADXL_POLL          1000    // ms between two checks of the activity latch
+#define ADXL_TILT_LIMIT    10      // Degrees from the mounting position that count as tampering
 #else
 #define MCP1               0x2F    // Direction of the mcp1 MICS
 #define MCP2               0x2E    // Direction of the mcp2 REGULATORS
@@ -146,7 +196,6 @@ static char* antennaExt[NETWORKS]  = {
 
 */
 
-#define MAX_MEMORY                                  571 //Memory size
 
 // SCK Configuration Parameters
 #define EE_ADDR_TIME_VERSION                        0   //32BYTES 
@@ -165,6 +214,28 @@ static char* antennaExt[NETWORKS]  = {
 #define DEFAULT_ADDR_AUTH                                470  //160 BYTES 
 #define DEFAULT_ADDR_ANTENNA                             630  //160 BYTES
 
+// SCK Extended Configuration Parameters (checked one by one, a bad value only resets itself)
+#define EE_ADDR_EVENT_ZSCORE                        790  //4BYTES z-score (tenths of sigma) that triggers an instant upload
+#define EE_ADDR_EVENT_LEVEL                         794  //12BYTES Absolute level per event channel (CO, NO2, NOISE)
+#define EE_ADDR_EVENT_RATE                          806  //12BYTES Change between readings per event channel (CO, NO2, NOISE)
+#define EE_ADDR_RADIO_BUDGET                        818  //4BYTES Seconds of radio time allowed per hour
+#define EE_ADDR_UPLOAD_BUDGET                       822  //4BYTES Seconds an upload cycle may spend flushing the memory
+#define EE_ADDR_UPLOAD_BYTES                        826  //4BYTES Bytes an upload cycle may send
+#define EE_ADDR_UPLOAD_ORDER                        830  //4BYTES Flush order (UPLOAD_OLDEST, UPLOAD_NEWEST)
+#define EE_ADDR_THIN_START                          834  //4BYTES % of memory used before old readings are merged
+#define EE_ADDR_THIN_DEEP                           838  //4BYTES % of memory used before the merge window doubles
+#define EE_ADDR_THIN_WINDOW                         842  //4BYTES Readings merged into one min/mean/max triple
+#define EE_ADDR_FIFO_LAYOUT                         846  //4BYTES FIFO_LAYOUT of the stored readings
+#define EE_ADDR_SHT21_RESOLUTION                    850  //4BYTES SHT21 resolution setting (0-3)
+#define EE_ADDR_GAS_PERIOD                          854  //4BYTES Minutes between two gas readings in ECONOMIC mode
+#define EE_ADDR_STATS_RATE                          858  //4BYTES Seconds between two samples of the interval statistics
+#define EE_ADDR_PERIOD                              862  //20BYTES Own sampling period (s) of climate, light, gas, analog and Wi-Fi scan, 0 = every upload
+#define EE_ADDR_ADAPT_LOW                           882  //4BYTES Change between readings (per mille) under which the interval doubles
+#define EE_ADDR_ADAPT_HIGH                          886  //4BYTES Change between readings (per mille) over which the interval halves, 0 = fixed interval
+#define EE_ADDR_THERMAL_TAU                         890  //4BYTES Time constant (s) of the self heating model, 0 = no compensation
+#define EE_ADDR_ADC_FILTER                          894  //4BYTES Estimator of every ADC channel, 2 bits each, and ADC_FILTER_SAVED
+#define EE_ADDR_CONFIG_END                          898  //First free address
+
 
 /*
 
@@ -174,6 +245,45 @@ static char* antennaExt[NETWORKS]  = {
 
 // SCK DATA SPACE (Sensor readings can be stored here to do batch updates)
 #define DEFAULT_ADDR_MEASURES                            0
+#define EXT_EEPROM_SIZE                                  32768  //24LC256
+
+// Every stored reading: the SENSORS values of this build, a header ((groups << 24) | (kind << 16) |
+// readings merged) and the time. Readings stored by a build with other channel groups are dropped
+// at boot (see SCKBase::eepromCheck())
+#define FIFO_HEADER     (SENSORS * 4)
+#define FIFO_TIME       ((SENSORS + 1) * 4)
+#define FIFO_RECORD     (FIFO_TIME + TIME_BUFFER_SIZE)
+#define FIFO_SIZE       (EXT_EEPROM_SIZE / FIFO_RECORD)      //Records in the ring (one is always kept free)
+#define FIFO_END        ((uint32_t)FIFO_SIZE * FIFO_RECORD)
+
+#define FIFO_RAW        0
+#define FIFO_MIN        1
+#define FIFO_MEAN       2
+#define FIFO_MAX        3
+
+// Optional channel groups, in their order in value[] (header bits 24-31 of a stored reading)
+#define FIFO_GROUP_OCTAVES    0
+#define FIFO_GROUP_VIBRATION  1
+#define FIFO_GROUP_STATS      2
+#define FIFO_GROUPS           (((NOISE_OCTAVES) ? _BV(FIFO_GROUP_OCTAVES) : 0) | (((VIBRATION)&&(F_CPU == 8000000)) ? _BV(FIFO_GROUP_VIBRATION) : 0) | ((INTERVAL_STATS) ? _BV(FIFO_GROUP_STATS) : 0))
+#define FIFO_LAYOUT           (((uint32_t)FIFO_GROUPS << 16) | FIFO_RECORD)
+
+#define FIFO_THIN_MAX         16     //Most records merged at once
+#define DEFAULT_THIN_START    75     //% of memory used before old readings are merged
+#define FIFO_THIN_BATCH       10     //% of memory freed by merging once the start mark is reached
+#define DEFAULT_THIN_DEEP     90     //% of memory used before the merge window doubles
+#define DEFAULT_THIN_WINDOW   8      //Readings merged into one min/mean/max triple
+#define DEFAULT_GAS_PERIOD    60     //Minutes between two gas readings in ECONOMIC mode
+#define DEFAULT_STATS_RATE    10     //Seconds between two samples of the interval statistics
+#define STATS_RATE_MIN        2      //The DHT22 can't be read faster
+#define STATS_RATE_MAX        3600
+#define PERIODS               5      //TASKS plus the Wi-Fi scan
+#define PERIOD_SCAN           4
+#define MAX_PERIOD            65535  //Seconds
+#define ADAPT_CHANNELS        6      //Channels driving the adaptive interval (temp, hum, light, CO, NO2, noise)
+#define MAX_ADAPT             10000  //Per mille
+#define DEFAULT_THERMAL_TAU   1200   //Seconds
+#define MAX_THERMAL_TAU       65535
 
 
 /*
@@ -186,6 +296,12 @@ static char* antennaExt[NETWORKS]  = {
 #define MICS_2710 0x01
 
 #define RES 256   // Digital pot. resolution
+#define MCP_FIRST         0x2D    // MCP3, the MCP1 and MCP2 addresses follow
+#define MCP_DEVICES       3
+#define MCP_SLOTS         (MCP_DEVICES * 4)  // Volatile wipers 0 to 3 of each device
+#define MCP_MASK          0x1FF   // 9 bit wiper value
+#define MCP_UNKNOWN       0xFFFF
+#define MCP_VERIFY_PERIOD 600000UL  // ms between two checks of the shadow wipers
 #define P1  100   //Digital potentiometer resistance 100Kohm
 
 #define  Rc0  10.       //Ohm.  Average current resistance for sensor MICS_5525/MICS_5524
@@ -205,8 +321,95 @@ static char* antennaExt[NETWORKS]  = {
 #endif
 
 #define reference 2560.
+
+/*
+
+  ADC SAMPLER - Background conversions, see SCKBase::adcBegin()
+
+*/
+
+#define ADC_CHANNELS     8     // S0-S5, BAT and PANEL
+#define ADC_SLOTS        14    // Conversions in one round, S4 takes every other one
+#define ADC_NOISE        4     // S4 in ADC_PINS
+#define ADC_WINDOW       64    // Samples averaged per channel (about 93ms for the slow channels)
+#define ADC_TIMEOUT      500   // ms waiting for a full window after a reference change
+#define ADC_BLOCK        8     // Samples per block of the robust estimators (about 12ms)
+#define ADC_BLOCKS       (ADC_WINDOW / ADC_BLOCK)
+#define ADC_MEAN         0     // average() estimators, per channel
+#define ADC_MEDIAN       1     // Median of the blocks
+#define ADC_TRIMMED      2     // Mean of the blocks without the ADC_TRIM lowest and highest
+#define ADC_HAMPEL       3     // Mean of the blocks, outliers replaced by the median
+#define ADC_TRIM         2
+#define ADC_HAMPEL_K     3     // Outlier limit in robust sigmas (1.4826 MAD)
+// Estimator of S0-S5, BAT and PANEL, 2 bits each: Hampel on the MICS, trimmed mean on their
+// heater sense, plain mean on the microphone and the LDR, median on the battery and the panel
+#define ADC_FILTER_SAVED   0x10000UL  // Tells a saved word from a blank EEPROM (0 or 0xFFFFFFFF)
+#define DEFAULT_ADC_FILTER ((uint32_t)ADC_HAMPEL | (ADC_HAMPEL << 2) | (ADC_TRIMMED << 4) | (ADC_TRIMMED << 6) | (ADC_MEAN << 8) | (ADC_MEAN << 10) | ((uint32_t)ADC_MEDIAN << 12) | ((uint32_t)ADC_MEDIAN << 14))
+#define NOISE_BURSTS     8     // Bursts averaged into the octave band levels
+#define NOISE_OCTAVE_MIN -1000 // dBFS x10 posted when a band has no energy
+#define MIC_GAIN_LOW     70    // Interval peak (ADC counts) under which the microphone gain goes up
+#define MIC_GAIN_HIGH    900   // Interval peak over which the gain goes down (x10 apart, no hunting)
+#define MIC_GAIN_MAX     10000
+#define MIC_GAIN_MIN     100
+
+/*
+
+  ACQUISITION - Tasks run side by side by SCKAmbient::runTasks(), each one in stages
+  separated by its conversion or settling waits
+
+*/
+
+#define TASK_CLIMATE     0     // SHT21 or DHT22
+#define TASK_LIGHT       1     // BH1730 or LDR
+#define TASK_GAS         2     // Vcc, heaters and MICS load resistors
+#define TASK_ANALOG      3     // Battery, panel and noise
+#define TASKS            4
+#define TASK_END         -1
+#define TASK_POLL        5     // ms between checks while a task waits on a device
+#define TASK_TIMEOUT     20000 // ms before the tasks still running are dropped
+#define SHT21_BUSY       0     // collectSHT21() results
+#define SHT21_OK         1
+#define SHT21_CRC        2
+#define SHT21_RETRIES    2     // Measurements repeated after a CRC error
+#define SHT21_RES_MAX    3     // User register resolution setting, 0 = RH 12 bits / T 14 bits
+#define SHT21_SLACK      20    // ms past twice the conversion time before the SHT21 is given up
+#define BH1730_RANGES    6     // Integration time and gain pairs, see SCKAmbient::startLight()
+#define BH1730_RANGE0    1     // 102.6ms x1, the range of the first reading
+#define BH1730_TARGET    40000 // Counts aimed at when a range is chosen
+#define BH1730_SATURATED 65000 // Counts from which the true level is unknown
+#define BH1730_RETRIES   1     // Readings repeated at once with a better range
+#define BH1730_ONE_SHOT  0x0B  // CONTROL: power, ADC enabled, one measurement
+#define BH1730_VALID     0x10  // CONTROL: ADC_VALID
+#define BH1730_SLACK     10    // ms
+#define MICS_SETTLE      100   // ms after a load resistor change
+#define MICS_RANGE_STEPS 8     // Most load resistor changes in one reading (8 bits of wiper)
+#define MICS_RANGE_LOW   0.3   // VL window, as a fraction of VMICS, that needs no change
+#define MICS_RANGE_HIGH  0.7
+#define MICS_RL_MIN      2000  // Ohm, lowest load resistor
+#define HEATER_TICK      250   // ms between two steps of the heater loops
+#define HEATER_SETTLE_MAX 10000 // ms the gas reading waits for the heater currents
+#define GAS_ON           0     // ECONOMIC duty cycle states, GAS_ON outside ECONOMIC
+#define GAS_WARMING      1
+#define GAS_OFF          2
+#define GAS_PERIOD_MIN   10    // Minutes, gas period limits
+#define GAS_PERIOD_MAX   1440
+#define GAS_WARMUP_POLL  20000 // ms between two gas readings while the sensors warm up
+#define GAS_WARMUP_MIN   60000 // ms of heating before a reading can count as warm
+#define GAS_WARMUP_MAX   360000UL // ms after which the reading is taken anyway
+#define GAS_STABLE_SLOPE 0.02  // Rs change per minute, as a fraction of Rs, seen as flat
+#define GAS_STABLE_READINGS 2  // Flat polls in a row before the sensors count as warm
+#define DHT_RETRIES      5
+#define DHT_RETRY_WAIT   3000
+#define DHT_START_WAIT   20    // ms the line is held low to request a frame
+#define DHT_FRAME_WAIT   10    // ms for the 5ms frame
+#define DHT_EDGES        42    // Falling edges of a frame: 2 of the response and 40 bits
+#define DHT_BIT_THRESHOLD 100  // us between falling edges over which the bit is a 1
+#define DHT_BIT_MARGIN   10    // us around the threshold where a bit is too close to call
+#define DHT_BIT_MIN      60    // us, shortest bit (50us low + 26us high, less the jitter)
+#define DHT_BIT_MAX      150   // us, longest bit (50us low + 70us high, plus the jitter)
 #define second 1000
 #define minute 60000
+#define hour   3600000UL
 
 /*
 
@@ -221,6 +424,18 @@ static char* antennaExt[NETWORKS]  = {
 #define  VAL_MAX_BATTERY                             4188 //4050
 #define  VAL_MIN_BATTERY                             3078 //3000
 #endif
+#define  BAT_POINTS                                  100  //Points of the discharge curve, see SCKBase::getBattery()
+#define  BAT_CAPACITY                                2000 //mAh
+#define  BAT_REST_TAU                                480  //Seconds for the estimate to follow the curve when not charging
+#define  BAT_CHARGE_TAU                              3840 //Same while charging, the coulomb count leads
+#define  BAT_CHARGE_HEADROOM                         500  //mV over the battery the charger input needs to give its full current
+#define  BAT_CV_VOLTAGE                              4150 //mV from which the charger holds the voltage and its current tapers off
+#define  BAT_CHARGE_CURRENT                          280  //mA of the fixed charger of the 1.0 board
+
+#define  THERMAL_RTH                                 25   //0.01C of steady rise per 100mW dissipated in the kit
+#define  THERMAL_RADIO_POWER                         300  //mW of the WiFly while it is on
+#define  THERMAL_BATTERY                             3700 //mV, battery side of the linear charger
+#define  THERMAL_POWER_MAX                           5000 //mW
 
 
 #define DHTLIB_INVALID_VALUE    -999
@@ -230,7 +445,38 @@ static char* antennaExt[NETWORKS]  = {
 #define NORMAL    2  //Nomal mode o real time
 #define ECONOMIC  3  //Economic mode, sensor gas active one time for hour
 
-#define  SENSORS 9  //Numbers of sensors in the board
+#if NOISE_OCTAVES
+#define  VALUE_VIBRATION 21
+#else
+#define  VALUE_VIBRATION 15
+#endif
+#define  VIBRATION_VALUES 5  // RMS, peak, dominant frequency, tilt and activity
+#if ((VIBRATION)&&(F_CPU == 8000000))
+#define  VALUE_STATS (VALUE_VIBRATION + VIBRATION_VALUES)
+#else
+#define  VALUE_STATS VALUE_VIBRATION
+#endif
+#define  STATS_CHANNELS 5  // Temperature, humidity, light, battery and noise
+#if INTERVAL_STATS
+#define  SENSORS (VALUE_STATS + 4 * STATS_CHANNELS)  //Numbers of values posted
+#else
+#define  SENSORS VALUE_STATS  //Numbers of values posted
+#endif
+
+// Position of the noise meter readings in value[] (dB x10)
+#define VALUE_LEQ   9
+#define VALUE_LMAX  10
+#define VALUE_L10   11
+#define VALUE_L90   12
+#define VALUE_GAIN  13  // Microphone gain used for the noise readings (0 when fixed)
+#define VALUE_INTERVAL 14  // Seconds since the previous reading, see SCKAmbient::adapt()
+// Position of the first octave band in value[] (dBFS x10), only with NOISE_OCTAVES
+#define VALUE_OCTAVE  15
+#define OCTAVE_BANDS  6
+// From VALUE_VIBRATION, vibration RMS (mg), peak (mg), dominant frequency (Hz), tilt from the
+// mounting position (degrees) and ADXL345 activity events since the last reading, only with VIBRATION
+// on the SCK 1.1
+// From VALUE_STATS, min, max, mean and stddev of every stats channel, only with INTERVAL_STATS
 
 #define buffer_length         32
 #define buffer_length2        2*buffer_length
@@ -269,53 +515,198 @@ static char* WEB[6] = {
 //  "User-Agent: SmartCitizen \n\n"
 //};
 
-// Data JSON structure
-static char* SERVER[11] = {
-  "{\"temp\":\"",
-  "\",\"hum\":\"",
-  "\",\"light\":\"",
-  "\",\"bat\":\"",
-  "\",\"panel\":\"",
-  "\",\"co\":\"",
-  "\",\"no2\":\"",
-  "\",\"noise\":\"",
-  "\",\"nets\":\"",
-  "\",\"timestamp\":\"",
-  "\"}"
-};
-
-static char* SENSOR[10] = {
-  "Temperature: ",
-  "Humidity: ",
-  "Light: ",
-  "Battery: ",
-  "Solar Panel: ",
-  "Carbon Monxide: ",
-  "Nitrogen Dioxide: ",
-  "Noise: ",
-  "Wifi Spots: ",
-  "UTC: "
-};
+// Labels of value[] in flash, one NUL terminated entry after another, see SCKBase::printLabel()
+// Data JSON structure, SENSORS + 2 entries
+static const char SERVER[] PROGMEM =
+  "{\"temp\":\"\0"
+  "\",\"hum\":\"\0"
+  "\",\"light\":\"\0"
+  "\",\"bat\":\"\0"
+  "\",\"panel\":\"\0"
+  "\",\"co\":\"\0"
+  "\",\"no2\":\"\0"
+  "\",\"noise\":\"\0"
+  "\",\"nets\":\"\0"
+  "\",\"leq\":\"\0"
+  "\",\"lmax\":\"\0"
+  "\",\"l10\":\"\0"
+  "\",\"l90\":\"\0"
+  "\",\"gain\":\"\0"
+  "\",\"interval\":\"\0"
+#if NOISE_OCTAVES
+  "\",\"oct63\":\"\0"
+  "\",\"oct125\":\"\0"
+  "\",\"oct250\":\"\0"
+  "\",\"oct500\":\"\0"
+  "\",\"oct1k\":\"\0"
+  "\",\"oct2k\":\"\0"
+#endif
+#if ((VIBRATION)&&(F_CPU == 8000000))
+  "\",\"vib_rms\":\"\0"
+  "\",\"vib_peak\":\"\0"
+  "\",\"vib_freq\":\"\0"
+  "\",\"tilt\":\"\0"
+  "\",\"activity\":\"\0"
+#endif
+#if INTERVAL_STATS
+  "\",\"temp_min\":\"\0"
+  "\",\"temp_max\":\"\0"
+  "\",\"temp_mean\":\"\0"
+  "\",\"temp_sd\":\"\0"
+  "\",\"hum_min\":\"\0"
+  "\",\"hum_max\":\"\0"
+  "\",\"hum_mean\":\"\0"
+  "\",\"hum_sd\":\"\0"
+  "\",\"light_min\":\"\0"
+  "\",\"light_max\":\"\0"
+  "\",\"light_mean\":\"\0"
+  "\",\"light_sd\":\"\0"
+  "\",\"bat_min\":\"\0"
+  "\",\"bat_max\":\"\0"
+  "\",\"bat_mean\":\"\0"
+  "\",\"bat_sd\":\"\0"
+  "\",\"noise_min\":\"\0"
+  "\",\"noise_max\":\"\0"
+  "\",\"noise_mean\":\"\0"
+  "\",\"noise_sd\":\"\0"
+#endif
+  "\",\"timestamp\":\"\0"
+  "\"}\0";
+
+// SENSORS + 1 entries
+static const char SENSOR[] PROGMEM =
+  "Temperature: \0"
+  "Humidity: \0"
+  "Light: \0"
+  "Battery: \0"
+  "Solar Panel: \0"
+  "Carbon Monxide: \0"
+  "Nitrogen Dioxide: \0"
+  "Noise: \0"
+  "Wifi Spots: \0"
+  "Noise Leq: \0"
+  "Noise Lmax: \0"
+  "Noise L10: \0"
+  "Noise L90: \0"
+  "Microphone gain: \0"
+  "Interval: \0"
+#if NOISE_OCTAVES
+  "Noise 63Hz: \0"
+  "Noise 125Hz: \0"
+  "Noise 250Hz: \0"
+  "Noise 500Hz: \0"
+  "Noise 1kHz: \0"
+  "Noise 2kHz: \0"
+#endif
+#if ((VIBRATION)&&(F_CPU == 8000000))
+  "Vibration RMS: \0"
+  "Vibration peak: \0"
+  "Vibration frequency: \0"
+  "Tilt: \0"
+  "Activity: \0"
+#endif
+#if INTERVAL_STATS
+  "Temperature min: \0"
+  "Temperature max: \0"
+  "Temperature mean: \0"
+  "Temperature stddev: \0"
+  "Humidity min: \0"
+  "Humidity max: \0"
+  "Humidity mean: \0"
+  "Humidity stddev: \0"
+  "Light min: \0"
+  "Light max: \0"
+  "Light mean: \0"
+  "Light stddev: \0"
+  "Battery min: \0"
+  "Battery max: \0"
+  "Battery mean: \0"
+  "Battery stddev: \0"
+  "Noise min: \0"
+  "Noise max: \0"
+  "Noise mean: \0"
+  "Noise stddev: \0"
+#endif
+  "UTC: \0";
 
-static char* UNITS[9] = {
+// SENSORS entries
+static const char UNITS[] PROGMEM =
 #if F_CPU == 8000000
-  " C RAW",
-  " % RAW",
+  " C RAW\0"
+  " % RAW\0"
 #else
-  " C",
-  " %",
+  " C\0"
+  " %\0"
 #endif
 #if F_CPU == 8000000
-  " lx",
+  " lx\0"
 #else
-  " %",
+  " %\0"
 #endif
-  " %",
-  " mV",
-  " kOhm",
-  " kOhm",
-  " mV",
-  "",
-};
+  " %\0"
+  " mV\0"
+  " kOhm\0"
+  " kOhm\0"
+  " mV\0"
+  "\0"
+  " dB\0"
+  " dB\0"
+  " dB\0"
+  " dB\0"
+  "\0"
+  " s\0"
+#if NOISE_OCTAVES
+  " dBFS\0"
+  " dBFS\0"
+  " dBFS\0"
+  " dBFS\0"
+  " dBFS\0"
+  " dBFS\0"
+#endif
+#if ((VIBRATION)&&(F_CPU == 8000000))
+  " mg\0"
+  " mg\0"
+  " Hz\0"
+  " deg\0"
+  "\0"
+#endif
+#if INTERVAL_STATS
+#if F_CPU == 8000000
+  " C RAW\0"
+  " C RAW\0"
+  " C RAW\0"
+  " C RAW\0"
+  " % RAW\0"
+  " % RAW\0"
+  " % RAW\0"
+  " % RAW\0"
+  " lx\0"
+  " lx\0"
+  " lx\0"
+  " lx\0"
+#else
+  " C\0"
+  " C\0"
+  " C\0"
+  " C\0"
+  " %\0"
+  " %\0"
+  " %\0"
+  " %\0"
+  " %\0"
+  " %\0"
+  " %\0"
+  " %\0"
+#endif
+  " %\0"
+  " %\0"
+  " %\0"
+  " %\0"
+  " mV\0"
+  " mV\0"
+  " mV\0"
+  " mV\0"
+#endif
+  "";
 
 #endif
@@ -0,0 +1,63 @@
+/*
+
+  EventDetector.h
+  Lightweight on-device detector used to bypass batching and post a reading at once.
+
+  - Running mean and variance (EWMA) with a z-score trigger.
+  - Absolute level trigger (fires when the level is crossed upwards).
+  - Rate of change trigger (difference between two consecutive readings).
+
+*/
+
+#ifndef SmartCitizen_EventDetector_h
+#define SmartCitizen_EventDetector_h
+
+#define EVENT_EWMA_ALPHA    0.1f   // Weight of the newest reading in the running mean/variance
+#define EVENT_WARMUP        10     // Readings needed before the z-score is trusted
+
+#include <Arduino.h>
+
+class EventDetector {
+  public:
+
+    void setup(long level_, long rate_)
+    {
+      level = level_;
+      rate = rate_;
+    }
+
+    // zscore is given in tenths of sigma (0 disables the statistical trigger)
+    boolean update(long x, uint16_t zscore)
+    {
+      boolean fired = false;
+      if (count > 0) {
+        if ((level > 0) && (x >= level) && (last < level)) fired = true;
+        if ((rate > 0) && (labs(x - last) >= rate)) fired = true;
+      }
+      float diff = (float)x - mean;
+      if ((zscore > 0) && (count >= EVENT_WARMUP)) {
+        // Flat signals would give a zero variance, keep a floor of 1% of the mean
+        float sigma = fabs(mean) / 100;
+        if (sigma < 1) sigma = 1;
+        float var_ = var;
+        if (var_ < sigma * sigma) var_ = sigma * sigma;
+        if (diff * diff * 100 >= (float)zscore * zscore * var_) fired = true;
+      }
+      if (count == 0) mean = x;
+      else {
+        mean += EVENT_EWMA_ALPHA * diff;
+        var = (1.0f - EVENT_EWMA_ALPHA) * (var + EVENT_EWMA_ALPHA * diff * diff);
+      }
+      if (count < EVENT_WARMUP) count++;
+      last = x;
+      return fired;
+    }
+
+    long level;
+    long rate;
+    float mean;
+    float var;
+    long last;
+    byte count;
+};
+#endif
@@ -0,0 +1,83 @@
+/*
+
+  HeaterLoop.h
+  PI control of a MICS heater current through its regulator voltage (VH).
+
+  - Velocity form: VH += KP (e - e_prev) + KI e, bumpless when it takes over a VH.
+  - Fixed point: current in 0.1mA, VH in mV x 2^HEATER_Q.
+  - VH clamped to what the regulator pot can give (no integral wind-up).
+  - settled() once the error stayed within HEATER_TOLERANCE for HEATER_STABLE ticks.
+
+*/
+
+#ifndef SmartCitizen_HeaterLoop_h
+#define SmartCitizen_HeaterLoop_h
+
+#include <Arduino.h>
+
+#define HEATER_Q          4
+#define HEATER_KP         64      // 4mV per 0.1mA of error change (about half the heater + sense resistance)
+#define HEATER_KI         32      // 2mV per 0.1mA of error and tick
+#define HEATER_TOLERANCE  5       // 0.5mA
+#define HEATER_STABLE     3       // Ticks within tolerance before the heater counts as settled
+
+class HeaterLoop {
+  public:
+
+    // target in 0.1mA, VH limits in mV
+    void setup(int16_t target_, long lo_, long hi_)
+    {
+      target = target_;
+      lo = lo_ << HEATER_Q;
+      hi = hi_ << HEATER_Q;
+    }
+
+    // Takes over from the VH already applied
+    void start(long vh)
+    {
+      u = vh << HEATER_Q;
+      stable = 0;
+      first = true;
+      active = true;
+    }
+
+    void stop()
+    {
+      active = false;
+      stable = 0;
+    }
+
+    // Returns the VH (mV) to apply for the measured current (0.1mA)
+    long update(int16_t measured)
+    {
+      int16_t e = target - measured;
+      if (first) {
+        prev = e;
+        first = false;
+      }
+      u += (long)HEATER_KP * (e - prev) + (long)HEATER_KI * e;
+      if (u < lo) u = lo;
+      if (u > hi) u = hi;
+      prev = e;
+      if (abs(e) <= HEATER_TOLERANCE) {
+        if (stable < 255) stable++;
+      }
+      else stable = 0;
+      return u >> HEATER_Q;
+    }
+
+    boolean settled()
+    {
+      return (active && (stable >= HEATER_STABLE));
+    }
+
+    int16_t target;
+    long u;
+    long lo;
+    long hi;
+    int16_t prev;
+    byte stable;
+    boolean first;
+    boolean active;
+};
+#endif
@@ -0,0 +1,332 @@
+/*
+
+  NoiseMeter.h
+  Sound level metering of the microphone channel (S4), fed from the ADC interrupt.
+
+  - Blocks of NOISE_BLOCK samples (about 106ms) give one short term level in dB x10.
+  - Leq from the mean energy of the blocks, Lmax from the loudest block.
+  - L10/L90 from a 2dB histogram of the block levels, 40 to 150dB.
+  - Integer arithmetic only in sample() and process(), 32 bits at most: the block
+    energies are summed per decade, the float maths is left to report().
+
+  The stock board feeds S4 from an envelope detector, so the block mean (mV) is mapped
+  to dB with the calibration in data/sensors/db.json. That calibration is for the highest
+  microphone gain: at a lower gain the mV are scaled up to it first, and over the top of
+  the table the envelope is taken as proportional to the pressure. With NOISE_A_WEIGHTING the input
+  is taken as raw audio: DC is removed and a Q15 approximation of the A curve (the
+  20.6, 107.7 and 737.9Hz high-pass poles, the rest is above Nyquist) is applied before
+  squaring. The interrupt only queues the samples, process() filters them from the main
+  loop. When the queue fills up (the loop held for more than about 13ms) the block in
+  progress is dropped, so the levels only cover the time the loop kept up.
+
+*/
+
+#ifndef SmartCitizen_NoiseMeter_h
+#define SmartCitizen_NoiseMeter_h
+
+#include <Arduino.h>
+#include "Constants.h"
+
+#define NOISE_BLOCK       512     // Samples per block (S4 is sampled at about 4.8kS/s)
+#define NOISE_FLOOR       300     // dB x10, block energies are stored relative to it
+#define NOISE_BIN_MIN     40      // dB of the first histogram bin
+#define NOISE_BIN_WIDTH   2       // dB
+#define NOISE_BINS        55      // 40 to 150dB
+#define NOISE_DECADES     13      // Energy sums, 10dB each from NOISE_FLOOR
+#define NOISE_A_OFFSET    200     // dB x10 of an RMS of one count, only with NOISE_A_WEIGHTING
+#define NOISE_DECADE      200     // dB x10 of a x10 in amplitude
+#define NOISE_POLE_0      31897   // exp(-2pi 20.6Hz / fs) in Q15
+#define NOISE_POLE_1      28466   // exp(-2pi 107.7Hz / fs) in Q15
+#define NOISE_POLE_2      12494   // exp(-2pi 737.9Hz / fs) in Q15
+#define NOISE_QUEUE       64      // Samples waiting for process(), a power of 2
+#define NOISE_SETTLE      192     // Samples filtered but not counted after a gap (5 x the 20.6Hz pole)
+
+// Envelope calibration from data/sensors/db.json (mV -> dB)
+static const uint16_t NOISE_CAL_MV[] PROGMEM = {
+  0, 2, 3, 6, 20, 40, 60, 75, 115, 150, 180, 220, 260, 300, 375, 430, 500, 575, 660, 720,
+  820, 900, 975, 1050, 1125, 1200, 1275, 1320, 1375, 1400, 1430, 1450, 1480, 1500, 1525, 1540,
+  1560, 1580, 1600, 1620, 1640, 1660, 1680, 1690, 1700, 1710, 1720, 1745, 1770, 1785, 1800,
+  1815, 1830, 1845, 1860, 1875
+};
+static const uint8_t NOISE_CAL_DB[] PROGMEM = {
+  50, 55, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71, 72, 73, 74,
+  75, 76, 77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 88, 89, 90,
+  91, 92, 93, 94, 95, 96, 97, 98, 99, 100, 101, 102, 103, 104, 105,
+  106, 107, 108, 109, 110
+};
+#define NOISE_CAL_POINTS  (sizeof(NOISE_CAL_DB))
+
+// 1000 x 10^(i/100), energy of the fractional part of a level in dB x10
+static const uint16_t NOISE_POW10[100] PROGMEM = {
+  1000, 1023, 1047, 1072, 1096, 1122, 1148, 1175, 1202, 1230, 1259, 1288, 1318, 1349, 1380, 1413, 1445, 1479, 1514, 1549,
+  1585, 1622, 1660, 1698, 1738, 1778, 1820, 1862, 1905, 1950, 1995, 2042, 2089, 2138, 2188, 2239, 2291, 2344, 2399, 2455,
+  2512, 2570, 2630, 2692, 2754, 2818, 2884, 2951, 3020, 3090, 3162, 3236, 3311, 3388, 3467, 3548, 3631, 3715, 3802, 3890,
+  3981, 4074, 4169, 4266, 4365, 4467, 4571, 4677, 4786, 4898, 5012, 5129, 5248, 5370, 5495, 5623, 5754, 5888, 6026, 6166,
+  6310, 6457, 6607, 6761, 6918, 7079, 7244, 7413, 7586, 7762, 7943, 8128, 8318, 8511, 8710, 8913, 9120, 9333, 9550, 9772
+};
+
+// 100 x log10(1 + i/16), used by log100()
+static const uint8_t NOISE_LOG10[16] PROGMEM = {
+  0, 3, 5, 7, 10, 12, 14, 16, 18, 19, 21, 23, 24, 26, 27, 29
+};
+
+class NoiseMeter {
+  public:
+
+    void setVcc(uint16_t vcc_)
+    {
+      vcc = vcc_;
+    }
+
+    // Highest microphone gain over the one in use (1, 10, 100...), the calibration is for the highest
+    void setGain(uint16_t scale_)
+    {
+      scale = scale_;
+      offset = 0;
+      for (uint16_t i = scale; i >= 10; i = i / 10) offset += NOISE_DECADE;
+    }
+
+    // Highest sample since the last call
+    uint16_t takePeak()
+    {
+      uint8_t oldSREG = SREG;
+      cli();
+      uint16_t temp = peak;
+      peak = 0;
+      SREG = oldSREG;
+      return temp;
+    }
+
+#if NOISE_OCTAVES
+    // Copies the next size samples into buffer, see captured()
+    void capture(int16_t *buffer, byte size)
+    {
+      uint8_t oldSREG = SREG;
+      cli();
+      burstSize = size;
+      burstCount = 0;
+      burst = buffer;
+      SREG = oldSREG;
+    }
+
+    boolean captured()
+    {
+      return (burst == 0);
+    }
+#endif
+
+    // Called from the ADC interrupt with every S4 conversion
+    void sample(uint16_t x)
+    {
+#if NOISE_OCTAVES
+      if (burst != 0) {
+        burst[burstCount] = x;
+        if (++burstCount >= burstSize) burst = 0;
+      }
+#endif
+      if (x > peak) peak = x;
+#if NOISE_A_WEIGHTING
+      if (queued >= NOISE_QUEUE) {
+        lost = true;
+        return;
+      }
+      queue[(queueTail + queued) & (NOISE_QUEUE - 1)] = x;
+      queued++;
+#else
+      sum += x;
+      if (++count < NOISE_BLOCK) return;
+      uint32_t mV = (sum * vcc) / (1023UL * NOISE_BLOCK) * scale;
+      sum = 0;
+      count = 0;
+      record(calibrate(mV));
+#endif
+    }
+
+    // Filters the samples queued by sample(), to be called from the main loop as often as it can
+    void process()
+    {
+#if NOISE_A_WEIGHTING
+      uint8_t oldSREG = SREG;
+      cli();
+      byte n = queued;
+      boolean gap = lost;
+      lost = false;
+      SREG = oldSREG;
+      // Only the interrupt adds and only here they are taken, the n queued stay in place
+      for (byte i = 0; i < n; i++) {
+        weigh(queue[queueTail]);
+        queueTail = (queueTail + 1) & (NOISE_QUEUE - 1);
+      }
+      oldSREG = SREG;
+      cli();
+      queued -= n;
+      SREG = oldSREG;
+      if (gap) {
+        // Samples were lost after the ones just filtered: the block can't be completed
+        sum = 0;
+        count = 0;
+        settle = NOISE_SETTLE;
+      }
+#endif
+    }
+
+    // Interval results in dB x10, the accumulators start again afterwards
+    void report(long *leq, long *lmax, long *l10, long *l90)
+    {
+      process();
+      uint32_t energy_[NOISE_DECADES];
+      uint8_t oldSREG = SREG;
+      cli();
+      for (byte i = 0; i < NOISE_DECADES; i++) energy_[i] = energy[i];
+      uint32_t blocks_ = blocks;
+      *lmax = (blocks > 0) ? max_ : 0;
+      *l10 = percentile(1);
+      *l90 = percentile(9);
+      clear();
+      SREG = oldSREG;
+      float total = 0;
+      float scale = 1;
+      for (byte i = 0; i < NOISE_DECADES; i++) {
+        total += energy_[i] * scale;
+        scale *= 10;
+      }
+      if (blocks_ == 0) *leq = 0;
+      else *leq = NOISE_FLOOR + 100 * log10(total / blocks_ / 1000);
+    }
+
+    // Starts a new interval, the block in progress is dropped too
+    void clear()
+    {
+      process();
+      uint8_t oldSREG = SREG;
+      cli();
+      sum = 0;
+      count = 0;
+      for (byte i = 0; i < NOISE_DECADES; i++) energy[i] = 0;
+      blocks = 0;
+      max_ = 0;
+      for (byte i = 0; i < NOISE_BINS; i++) hist[i] = 0;
+      SREG = oldSREG;
+    }
+
+  private:
+
+    // 100 x log10(x), integer only
+    static int16_t log100(uint32_t x)
+    {
+      byte n = 31;
+      while (!(x & 0x80000000UL)) {
+        x <<= 1;
+        n--;
+      }
+      byte f = (x >> 27) & 0x0F;
+      return ((uint32_t)n * 30103) / 1000 + pgm_read_byte(NOISE_LOG10 + f);
+    }
+
+    static int16_t calibrate(uint32_t mV)
+    {
+      byte i = 1;
+      while ((i < NOISE_CAL_POINTS) && (pgm_read_word(NOISE_CAL_MV + i) < mV)) i++;
+      if (i >= NOISE_CAL_POINTS) {
+        // Over the table: 20dB per decade of mV from its last point
+        uint16_t top = pgm_read_word(NOISE_CAL_MV + NOISE_CAL_POINTS - 1);
+        return pgm_read_byte(NOISE_CAL_DB + NOISE_CAL_POINTS - 1) * 10 + 2 * (log100(mV) - log100(top));
+      }
+      uint16_t x0 = pgm_read_word(NOISE_CAL_MV + i - 1);
+      uint16_t x1 = pgm_read_word(NOISE_CAL_MV + i);
+      int16_t y0 = pgm_read_byte(NOISE_CAL_DB + i - 1) * 10;
+      int16_t y1 = pgm_read_byte(NOISE_CAL_DB + i) * 10;
+      return y0 + (int32_t)(mV - x0) * (y1 - y0) / (x1 - x0);
+    }
+
+#if NOISE_A_WEIGHTING
+    void weigh(uint16_t x)
+    {
+      dc += ((int32_t)x << 8) - (dc >> 8);
+      int16_t y = (x << 2) - (int16_t)(dc >> 14);
+      y = highPass(0, y, NOISE_POLE_0);
+      y = highPass(1, y, NOISE_POLE_1);
+      y = highPass(2, y, NOISE_POLE_2);
+      if (settle > 0) {
+        settle--;
+        return;
+      }
+      sum += ((int32_t)y * y) >> 8;
+      if (++count < NOISE_BLOCK) return;
+      // sum / NOISE_BLOCK is the mean square in counts^2 / 16, 100 x log10(16) = 120
+      uint32_t ms = sum / NOISE_BLOCK;
+      sum = 0;
+      count = 0;
+      record((ms > 0) ? NOISE_A_OFFSET + log100(ms) + 120 + offset : NOISE_FLOOR);
+    }
+
+    // y[n] = a (y[n-1] + x[n] - x[n-1])
+    int16_t highPass(byte stage, int16_t x, int16_t a)
+    {
+      int32_t t = (int32_t)hpY[stage] + x - hpX[stage];
+      hpX[stage] = x;
+      hpY[stage] = (t * a) >> 15;
+      return hpY[stage];
+    }
+#endif
+
+    void record(int16_t level)
+    {
+      if (level < NOISE_FLOOR) level = NOISE_FLOOR;
+      if (level >= NOISE_FLOOR + NOISE_DECADES * 100) level = NOISE_FLOOR + NOISE_DECADES * 100 - 1;
+      if (level > max_) max_ = level;
+      int16_t bin = (level / 10 - NOISE_BIN_MIN) / NOISE_BIN_WIDTH;
+      if (bin < 0) bin = 0;
+      if (bin >= NOISE_BINS) bin = NOISE_BINS - 1;
+      if (hist[bin] == 0xFFFF) {
+        // Long intervals: halve every bin, the percentiles don't change
+        for (byte i = 0; i < NOISE_BINS; i++) hist[i] >>= 1;
+      }
+      hist[bin]++;
+      // An hour of blocks at the top of a decade stays under 2^32
+      uint16_t d = level - NOISE_FLOOR;
+      energy[d / 100] += pgm_read_word(NOISE_POW10 + d % 100);
+      blocks++;
+    }
+
+    // Level exceeded tenths/10 of the time, from the top of the histogram
+    long percentile(byte tenths)
+    {
+      uint32_t total = 0;
+      for (byte i = 0; i < NOISE_BINS; i++) total += hist[i];
+      if (total == 0) return 0;
+      uint32_t acc = 0;
+      for (int i = NOISE_BINS - 1; i >= 0; i--) {
+        acc += hist[i];
+        if (acc * 10 >= total * tenths) return (i * NOISE_BIN_WIDTH + NOISE_BIN_MIN) * 10 + NOISE_BIN_WIDTH * 5;
+      }
+      return NOISE_BIN_MIN * 10;
+    }
+
+    uint16_t vcc;
+    uint16_t scale;
+    int16_t offset;           // dB x10 of scale, only with NOISE_A_WEIGHTING
+    volatile uint16_t peak;
+    uint32_t sum;
+    uint16_t count;
+    uint32_t energy[NOISE_DECADES];   // Block energies (1000 at NOISE_FLOOR) of every decade over it
+    uint32_t blocks;
+    int16_t max_;
+    uint16_t hist[NOISE_BINS];
+#if NOISE_OCTAVES
+    int16_t * volatile burst;
+    volatile byte burstCount;
+    byte burstSize;
+#endif
+#if NOISE_A_WEIGHTING
+    int32_t dc;
+    int16_t hpX[3];
+    int16_t hpY[3];
+    uint16_t queue[NOISE_QUEUE];
+    volatile byte queued;
+    byte queueTail;
+    volatile boolean lost;    // The queue was full, samples were dropped
+    uint16_t settle;
+#endif
+};
+#endif
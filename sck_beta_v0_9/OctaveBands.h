@@ -0,0 +1,123 @@
+/*
+
+  OctaveBands.h
+  1/1 octave band energies of a burst of microphone samples (S4 at about 4808S/s).
+
+  - NOISE_FFT_SIZE real samples, Hann window, packed as a 64 point complex FFT.
+  - Fixed point (Q15 twiddles from a PROGMEM quarter sine), halved at every stage.
+  - The buffer is the caller's, so nothing stays in RAM between readings.
+
+  Bands: 63, 125, 250, 500, 1k and 2k Hz (the 2k band stops at Nyquist).
+
+*/
+
+#ifndef SmartCitizen_OctaveBands_h
+#define SmartCitizen_OctaveBands_h
+
+#include <Arduino.h>
+#include "Constants.h"
+
+#define NOISE_FFT_SIZE    128     // Real samples per burst, 37.6Hz per bin
+#define NOISE_FFT_HALF    64      // Complex points of the packed FFT
+
+// 32768 x sin(2pi i / 128) for a quarter turn
+static const uint16_t OCTAVE_SIN[33] PROGMEM = {
+  0, 1608, 3212, 4808, 6393, 7962, 9512, 11039, 12540, 14010, 15447, 16846, 18205, 19520, 20788, 22006,
+  23170, 24279, 25330, 26320, 27246, 28106, 28899, 29622, 30274, 30853, 31357, 31786, 32138, 32413, 32610, 32729,
+  32767
+};
+
+// First bin of every band, the last one closes the 2k band
+static const uint8_t OCTAVE_BIN[OCTAVE_BANDS + 1] PROGMEM = {2, 3, 5, 10, 19, 38, 64};
+
+class OctaveBands {
+  public:
+
+    // data holds NOISE_FFT_SIZE ADC samples and is overwritten, band gets |X|^2 per band
+    static void analyse(int16_t *data, uint32_t *band)
+    {
+      long mean = 0;
+      for (byte n = 0; n < NOISE_FFT_SIZE; n++) mean += data[n];
+      mean = mean / NOISE_FFT_SIZE;
+      for (byte n = 0; n < NOISE_FFT_SIZE; n++) {
+        int32_t x = (int32_t)(data[n] - mean) << 4;
+        data[n] = (x * ((32768L - qcos(n)) >> 1)) >> 15; // Hann
+      }
+      fft(data);
+
+      for (byte i = 0; i < OCTAVE_BANDS; i++) band[i] = 0;
+      byte i = 0;
+      for (byte k = pgm_read_byte(OCTAVE_BIN); k < NOISE_FFT_HALF; k++) {
+        while (k >= pgm_read_byte(OCTAVE_BIN + i + 1)) i++;
+        // Split of the packed spectrum: X[k] = Fe[k] + W^k Fo[k]
+        int32_t zr = data[2 * k];
+        int32_t zi = data[2 * k + 1];
+        int32_t cr = data[2 * (NOISE_FFT_HALF - k)];
+        int32_t ci = -data[2 * (NOISE_FFT_HALF - k) + 1];
+        int32_t er = (zr + cr) >> 1;
+        int32_t ei = (zi + ci) >> 1;
+        int32_t or_ = (zi - ci) >> 1;
+        int32_t oi = -(zr - cr) >> 1;
+        int32_t wr = qcos(k);
+        int32_t wi = -qsin(k);
+        int32_t xr = er + ((wr * or_ - wi * oi) >> 15);
+        int32_t xi = ei + ((wr * oi + wi * or_) >> 15);
+        band[i] += (uint32_t)(xr * xr) + (uint32_t)(xi * xi);
+      }
+    }
+
+  private:
+
+    // Angles in 1/128 of a turn
+    static int16_t qsin(byte i)
+    {
+      i &= 0x7F;
+      if (i < 32) return pgm_read_word(OCTAVE_SIN + i);
+      if (i < 64) return pgm_read_word(OCTAVE_SIN + 64 - i);
+      if (i < 96) return -(int16_t)pgm_read_word(OCTAVE_SIN + i - 64);
+      return -(int16_t)pgm_read_word(OCTAVE_SIN + 128 - i);
+    }
+
+    static int16_t qcos(byte i)
+    {
+      return qsin(i + 32);
+    }
+
+    // In place radix 2 FFT of NOISE_FFT_HALF interleaved complex points, result / NOISE_FFT_HALF
+    static void fft(int16_t *data)
+    {
+      for (byte i = 1, j = 0; i < NOISE_FFT_HALF; i++) {
+        byte bit = NOISE_FFT_HALF >> 1;
+        for (; j & bit; bit >>= 1) j ^= bit;
+        j ^= bit;
+        if (i < j) {
+          int16_t temp = data[2 * i];
+          data[2 * i] = data[2 * j];
+          data[2 * j] = temp;
+          temp = data[2 * i + 1];
+          data[2 * i + 1] = data[2 * j + 1];
+          data[2 * j + 1] = temp;
+        }
+      }
+      for (byte size = 2; size <= NOISE_FFT_HALF; size <<= 1) {
+        byte half = size >> 1;
+        for (byte m = 0; m < half; m++) {
+          byte t = m * (NOISE_FFT_SIZE / size);
+          int32_t wr = qcos(t);
+          int32_t wi = -qsin(t);
+          for (byte i = m; i < NOISE_FFT_HALF; i += size) {
+            byte j = i + half;
+            int32_t tr = (wr * data[2 * j] - wi * data[2 * j + 1]) >> 15;
+            int32_t ti = (wr * data[2 * j + 1] + wi * data[2 * j]) >> 15;
+            int32_t ur = data[2 * i];
+            int32_t ui = data[2 * i + 1];
+            data[2 * j] = (ur - tr) >> 1;
+            data[2 * j + 1] = (ui - ti) >> 1;
+            data[2 * i] = (ur + tr) >> 1;
+            data[2 * i + 1] = (ui + ti) >> 1;
+          }
+        }
+      }
+    }
+};
+#endif
@@ -27,8 +27,60 @@
 #if ((decouplerComp)&&(F_CPU > 8000000 ))
 #include "TemperatureDecoupler.h"
 TemperatureDecoupler decoupler; // Compensate the bat .charger generated heat affecting temp values
+#else
+#include "ThermalModel.h"
+ThermalModel thermal;           // Heat of the charger and the radio reaching the temperature sensor
+unsigned long thermalAt = 0;
+uint32_t thermalRadio = 0;      // Radio ms since boot at the last update
+#endif
+
+#if NOISE_OCTAVES
+#include "OctaveBands.h"
 #endif
 
+#include "HeaterLoop.h"
+HeaterLoop heaters[2];        // MICS_5525 and MICS_2710 heater currents
+unsigned long timeHeater = 0; // Last tick of the heater loops
+
+#if INTERVAL_STATS
+#include "Welford.h"
+Welford stats[STATS_CHANNELS];  // Samples of the cheap channels between two uploads
+static byte STATS_VALUE[STATS_CHANNELS] = {0, 1, 2, 3, 7};   // Position of each stats channel in value[]
+uint32_t statsRate = DEFAULT_STATS_RATE;  // Seconds between two samples
+unsigned long timeStats = 0;
+#endif
+
+#include "EventDetector.h"
+EventDetector events[EVENT_CHANNELS]; // Bypass batching when CO, NO2 or NOISE behave unexpectedly
+static byte EVENT_VALUE[EVENT_CHANNELS] = {5, 6, 7};   // Position of each watched channel in value[]
+static char* EVENT_NAME[EVENT_CHANNELS] = {"co ", "no2 ", "noise "};
+uint16_t eventZscore = 0;
+boolean gasFresh = false;   // CO and NO2 in value[] were stored since the last checkEvents()
+
+// Own sampling period per task, plus the Wi-Fi scan (seconds, 0 = at every upload)
+static char* PERIOD_NAME[PERIODS] = {"climate ", "light ", "gas ", "analog ", "scan "};
+
+// ADC channels for 'set filter', in the order of SCKBase ADC_PINS
+static char* FILTER_NAME[ADC_CHANNELS] = {"s0 ", "s1 ", "s2 ", "s3 ", "s4 ", "s5 ", "bat ", "panel "};
+uint16_t period[PERIODS];
+unsigned long periodAt[PERIODS];   // Last run of every channel with its own period
+
+// Adaptive interval, see adapt()
+static byte ADAPT_VALUE[ADAPT_CHANNELS] = {0, 1, 2, 5, 6, 7};   // Position of each channel in value[]
+// Smallest reading a change is divided by, so readings near 0 (light at night, a temperature
+// around 0C) don't count as huge changes: 10C, 10%, 10lx (10%), 10kOhm, 1kOhm and 100mV
+#if F_CPU == 8000000
+static long ADAPT_FLOOR[ADAPT_CHANNELS] = {3730, 5243, 100, 10000, 1000, 100};
+#else
+static long ADAPT_FLOOR[ADAPT_CHANNELS] = {100, 100, 100, 10000, 1000, 100};
+#endif
+long adaptLast[ADAPT_CHANNELS];
+uint32_t adaptLow = 0;       // Per mille
+uint32_t adaptHigh = 0;      // Per mille, 0 = TimeUpdate is used as is
+uint32_t adaptLevel = 0;     // Recent change between readings (per mille, smoothed)
+uint32_t adaptInterval = 0;  // Seconds to the next reading, 0 = TimeUpdate
+byte adaptSeen = 0;          // Channels with a previous reading in adaptLast
+
 
 long value[SENSORS];
 char time[TIME_BUFFER_SIZE];
@@ -56,13 +108,27 @@ uint32_t lastTemperature;
 int accel_x = 0;
 int accel_y = 0;
 int accel_z = 0;
+#if VIBRATION
+long vibRms = 0;             // Strongest burst since the last reading (mg)
+long vibPeak = 0;            // mg
+long vibFreq = 0;            // Hz, of the strongest burst
+long tilt = 0;               // Degrees from tiltRef
+long tiltRef[3];             // Mean of the first burst after boot, the mounting position
+boolean tiltRefOk = false;
+int16_t vibMean[3];          // Mean of the last burst, the zero crossings are counted around it
+boolean vibMeanOk = false;
+boolean tamper = false;      // Tilt went over ADXL_TILT_LIMIT, posted at once
+uint16_t activityCount = 0;
+unsigned long timeADXL = 0;
+#endif
 #else
 int lastHumidity;
 int lastTemperature;
 #endif
 
 void SCKAmbient::begin() {
-  _server = &SCKServer(_base);
+  static SCKServer server(_base); // Must outlive begin(), it keeps the connection manager state
+  _server = &server;
   _base.begin();
 #if ((decouplerComp)&&(F_CPU > 8000000 ))
   decoupler.setup();
@@ -81,6 +147,13 @@ void SCKAmbient::begin() {
 
   pinMode(IO3, OUTPUT);
   digitalWrite(IO3, HIGH);     // MICS POWER LINE
+  writeADXL(ADXL_BW_RATE, ADXL_RATE);
+  writeADXL(ADXL_FIFO_CTL, ADXL_STREAM);  // Keeps the last 32 samples, see averageADXL()
+#if VIBRATION
+  writeADXL(ADXL_THRESH_ACT, ADXL_ACT_LEVEL);
+  writeADXL(ADXL_ACT_CTL, ADXL_ACT_AC_XYZ);
+  writeADXL(ADXL_INT_ENABLE, ADXL_ACTIVITY);
+#endif
   writeADXL(0x2D, 0x08);
   //  WriteADXL(0x31, 0x00); //2g
   //  WriteADXL(0x31, 0x01); //4g
@@ -115,8 +188,42 @@ uint32_t  nets           = 0;
 boolean sleep         = true;
 uint32_t timetransmit = 0;
 uint32_t timeMICS = 0;
+uint32_t gasPeriod = DEFAULT_GAS_PERIOD; // Minutes between two gas readings in ECONOMIC mode
+byte gasCycle = GAS_WARMING;   // ECONOMIC duty cycle state
+byte gasStable = 0;            // Gas polls in a row with a flat Rs
+float gasLastCO = 0;           // Rs of the previous warm-up poll
+float gasLastNO2 = 0;
+unsigned long gasLastAt = 0;
 boolean RTCupdatedSinceBoot = false;
 
+byte taskStage[TASKS];
+unsigned long taskAt[TASKS];
+boolean climateOk = false;   // Last climate task gave a valid reading
+boolean analogBusy = false;  // Reference switched for Vcc, the other analog reads wait
+volatile boolean postPending = false;  // 'post data' typed, execute() posts outside the serial interrupt
+float vccDefault = 0;        // S3 with the default reference
+byte micsRange = 0;          // Sensors still bisecting their load resistor
+byte micsSteps = 0;          // Settling steps of the search so far
+int micsWiper[2] = {0, 0};   // Load resistor wipers kept between readings
+int micsLow[2];              // Wiper bracket of the search
+int micsHigh[2];
+unsigned long heatStart = 0; // Heaters handed to their loops for this reading
+unsigned long timeMCP = 0;   // Last check of the digital pots against their shadow copy
+uint32_t lastLight = 0;
+byte lightRange = BH1730_RANGE0;  // Position in BH1730_TIME/BH1730_GAIN of the next reading
+byte lightUsed = BH1730_RANGE0;   // Range of the reading in progress
+byte lightRetry = 0;
+unsigned long lightStart = 0;
+
+#if F_CPU == 8000000
+// SHT21 conversion times (ms) for each resolution setting of the user register
+static byte SHT21_TEMP_WAIT[4] = {85, 22, 43, 11};  // T 14, 12, 13 and 11 bits
+static byte SHT21_HUM_WAIT[4]  = {29, 4, 9, 15};    // RH 12, 8, 10 and 11 bits
+byte shtResolution = 0;      // Setting in the sensor, 0 after a power up
+byte shtErrors = 0;
+unsigned long shtStart = 0;  // Last measurement started
+#endif
+
 void SCKAmbient::ini()
 {
   _base.setDebugState(false);
@@ -126,9 +233,23 @@ void SCKAmbient::ini()
   TimeUpdate = _base.readData(EE_ADDR_TIME_UPDATE, INTERNAL);    //Time between transmissions in sec.
   NumUpdates = _base.readData(EE_ADDR_NUMBER_UPDATES, INTERNAL); //Number of readings before batch update
   nets = _base.readData(EE_ADDR_NUMBER_NETS, INTERNAL);
+  gasPeriod = _base.readData(EE_ADDR_GAS_PERIOD, INTERNAL);
+#if INTERVAL_STATS
+  statsRate = _base.readData(EE_ADDR_STATS_RATE, INTERNAL);
+#endif
+  loadEvents();
+  loadPeriods();
+#if !((decouplerComp)&&(F_CPU > 8000000 ))
+  thermal.setup(_base.readData(EE_ADDR_THERMAL_TAU, INTERNAL));
+#endif
+  adaptLow = _base.readData(EE_ADDR_ADAPT_LOW, INTERNAL);
+  adaptHigh = _base.readData(EE_ADDR_ADAPT_HIGH, INTERNAL);
+  _base.noise().setVcc(Vcc);
+  _base.noise().setGain(1);  // The microphone starts at MIC_GAIN_MAX
+  _server->link().setup(_base.readData(EE_ADDR_RADIO_BUDGET, INTERNAL));
   if (TimeUpdate * NumUpdates < 60) sleep = false;
   else sleep = true;
-  if (_base.connect()) {
+  if (_server->join()) {
 #if debugEnabled
     if (!_base.getDebugState()) Serial.println(F("SCK Connected to Wi-Fi!!"));
 #endif
@@ -153,6 +274,7 @@ void SCKAmbient::ini()
       if (!_base.getDebugState()) Serial.println(F("RTC Update Failed!!"));
 #endif
     }
+    _server->leave(RTCupdatedSinceBoot);
   } else {
 #if debugEnabled
     if (!_base.getDebugState()) {
@@ -164,7 +286,12 @@ void SCKAmbient::ini()
     }
 #endif
   }
-  timetransmit = millis();
+  // Kits that boot together must not post together: the first reading is delayed by a
+  // per device phase inside the update interval, derived from the MAC. The jitter of the
+  // backoffs is seeded with the boot time and the microphone noise too, so it changes per boot
+  uint32_t hash = _base.hashMAC();
+  randomSeed(hash ^ micros() ^ ((uint32_t)(_base.average(S4) * 1000) << 16));
+  timetransmit = millis() - TimeUpdate * second + hash % (TimeUpdate * second);
   wait_moment = false;
   timeMICS = millis();
 }
@@ -216,13 +343,19 @@ float kr1 = ((float)P1 * 1000) / RES; //  Resistance conversion Constant for the
 
 void SCKAmbient::writeRL(byte device, long resistor)
 {
-  int data = 0x00;
-  data = (int)(resistor / kr1);
+  writeWiperRL(device, (int)(resistor / kr1));
+}
+
+void SCKAmbient::writeWiperRL(byte device, int data)
+{
+  if (data > RES) data = RES;
+  if (data < 0) data = 0;
 #if F_CPU == 8000000
   _base.writeMCP(MCP1, device + 6, data);
 #else
   _base.writeMCP(MCP1, device, data);
 #endif
+  micsWiper[device] = data;
 }
 
 float SCKAmbient::readRL(byte device)
@@ -246,8 +379,12 @@ float SCKAmbient::readRGAIN(byte device)
   return (kr1 * _base.readMCP(MCP2, device));  // Returns Resistance (Ohms)
 }
 
+long gainCache = 0;   // Gain last written to the pots, 0 = unknown
+long micGain = MIC_GAIN_MAX;
+
 void SCKAmbient::writeGAIN(long value)
 {
+  if (value == gainCache) return; // Nothing to settle
   if (value == 100) {
     writeRGAIN(0x00, 10000);
     writeRGAIN(0x01, 10000);
@@ -260,6 +397,8 @@ void SCKAmbient::writeGAIN(long value)
     writeRGAIN(0x00, 100000);
     writeRGAIN(0x01, 100000);
   }
+  else return;
+  gainCache = value;
   delay(100);
 }
 
@@ -268,48 +407,54 @@ float SCKAmbient::readGAIN()
   return (readRGAIN(0x00) / 1000) * (readRGAIN(0x01) / 1000);
 }
 
-void SCKAmbient::getVcc()
+void SCKAmbient::heat(byte device, int current)
 {
-  float temp = _base.average(S3);
-  analogReference(INTERNAL);
-  delay(100);
-  Vcc = (float)(_base.average(S3) / temp) * reference;
-  analogReference(DEFAULT);
-  delay(100);
+  // Hands the heater to its control loop, see heaterTick()
+#if F_CPU == 8000000
+  long lo = 1000 * 0.41;
+  long hi = (RES / k + 1000) * 0.41;
+#else
+  long lo = 1000 * 1.2;
+  long hi = (RES / k + 1000) * 1.2;
+#endif
+  heaters[device].setup(current * 10, lo, hi);
+  if (!heaters[device].active) heaters[device].start(readVH(device));
+#if debugAmbient
+  if (device == MICS_2710) Serial.println("MICS2710 heating...");
+  else Serial.println("MICS5525 heating...");
+#endif
 }
 
-void SCKAmbient::heat(byte device, int current)
+void SCKAmbient::heaterTick()
 {
-  float Rc = Rc0;
-  byte Sensor = S2;
-  if (device == MICS_2710) {
-    Rc = Rc1;
-    Sensor = S3;
-  }
-
-  float Vc = (float)_base.average(Sensor) * Vcc / 1023; //mV
-  float current_measure = Vc / Rc; //mA
-  float Rh = (readVH(device) - Vc) / current_measure;
-  float Vh = (Rh + Rc) * current;
-
-  writeVH(device, Vh);
+  if ((millis() - timeHeater) < HEATER_TICK) return;
+  timeHeater = millis();
+  if (analogBusy) return;     // Vcc measurement in progress, S2/S3 are not against Vcc
+  for (byte device = MICS_5525; device <= MICS_2710; device++) {
+    if (!heaters[device].active) continue;
+    long Rc = Rc0;
+    byte Sensor = S2;
+    if (device == MICS_2710) {
+      Rc = Rc1;
+      Sensor = S3;
+    }
+    // Current in 0.1mA from the voltage across the sense resistor
+    long measured = (long)(_base.average(Sensor) * 10) * (long)Vcc / (1023L * Rc);
+    writeVH(device, heaters[device].update(measured));
 #if debugAmbient
-  if (device == MICS_2710) Serial.print("MICS2710 current: ");
-  else Serial.print("MICS5525 current: ");
-  Serial.print(current_measure);
-  Serial.println(" mA");
-  if (device == MICS_2710) Serial.print("MICS2710 correction VH: ");
-  else  Serial.print("MICS5525 correction VH: ");
-  Serial.print(readVH(device));
-  Serial.println(" mV");
-  Vc = (float)_base.average(Sensor) * Vcc / 1023; //mV
-  current_measure = Vc / Rc; //mA
-  if (device == MICS_2710) Serial.print("MICS2710 current adjusted: ");
-  else Serial.print("MICS5525 current adjusted: ");
-  Serial.print(current_measure);
-  Serial.println(" mA");
-  Serial.println("Heating...");
+    if (device == MICS_2710) Serial.print("MICS2710 current: ");
+    else Serial.print("MICS5525 current: ");
+    Serial.print(measured / 10.);
+    Serial.print(" mA, VH: ");
+    Serial.print(heaters[device].u >> HEATER_Q);
+    Serial.println(" mV");
 #endif
+  }
+}
+
+boolean SCKAmbient::heaterSettled()
+{
+  return (heaters[MICS_5525].settled() && heaters[MICS_2710].settled());
 }
 
 float SCKAmbient::readRs(byte device)
@@ -335,19 +480,34 @@ float SCKAmbient::readRs(byte device)
   return Rs;
 }
 
-float SCKAmbient::readMICS(byte device)
+// Bisects the load resistor toward VL = VMICS / 2, true while it needs another MICS_SETTLE
+boolean SCKAmbient::rangeMICS(byte device, boolean first)
 {
-  float Rs = readRs(device);
-  float RL = readRL(device); //Ohm
-
-  // Charging impedance correction
-  if ((Rs <= (RL - 1000)) || (Rs >= (RL + 1000))) {
-    if (Rs < 2000) writeRL(device, 2000);
-    else writeRL(device, Rs);
-    delay(100);
-    Rs = readRs(device);
+  byte Sensor = S0;
+  float VMICS = VMIC0;
+  if (device == MICS_2710) {
+    Sensor = S1;
+    VMICS = VMIC1;
   }
-  return Rs;
+  if (first) {
+    // The search starts from the wiper cached by the last reading
+    micsLow[device] = MICS_RL_MIN / kr1;
+    micsHigh[device] = RES;
+  }
+  float VL = ((float)_base.average(Sensor) * Vcc) / 1023; //mV
+  if ((VL > VMICS * MICS_RANGE_LOW) && (VL < VMICS * MICS_RANGE_HIGH)) return false;
+  // VL = VMICS RL / (Rs + RL), too high when RL is above Rs
+  if (VL > VMICS / 2) micsHigh[device] = micsWiper[device];
+  else micsLow[device] = micsWiper[device];
+  if ((micsHigh[device] - micsLow[device]) < 2) return false;
+  writeWiperRL(device, (micsLow[device] + micsHigh[device]) / 2);
+#if debugAmbient
+  if (device == MICS_5525) Serial.print("MICS5525 RL: ");
+  else Serial.print("MICS2710 RL: ");
+  Serial.print(readRL(device));
+  Serial.println(" Ohm");
+#endif
+  return true;
 }
 
 void SCKAmbient::GasSensor(boolean active)
@@ -365,6 +525,8 @@ void SCKAmbient::GasSensor(boolean active)
 #endif
   }
   else {
+    heaters[MICS_5525].stop();
+    heaters[MICS_2710].stop();
 #if F_CPU == 8000000
     digitalWrite(IO0, LOW);     // MICS5525
     digitalWrite(IO1, LOW);     // MICS2710_HEATHER
@@ -380,44 +542,68 @@ void SCKAmbient::GasSensor(boolean active)
 
 void SCKAmbient::getMICS()
 {
-  // Charging tension heaters
-  heat(MICS_5525, 32); //Corriente en mA
-  heat(MICS_2710, 26); //Corriente en mA
-
-  RsCO = readMICS(MICS_5525);
-  RsNO2 = readMICS(MICS_2710);
-
+  runTasks(_BV(TASK_GAS));
 }
 
 #if F_CPU == 8000000
-uint16_t SCKAmbient::readSHT21(uint8_t type)
+void SCKAmbient::startSHT21(uint8_t type)
 {
-  uint16_t DATA = 0;
   Wire.beginTransmission(Temperature);
   Wire.write(type);
   Wire.endTransmission();
-  Wire.requestFrom(Temperature, 2);
-  unsigned long time = millis();
-  while (!Wire.available()) if ((millis() - time) > 500) return 0x00;
-  DATA = Wire.read() << 8;
-  while (!Wire.available());
-  DATA = (DATA | Wire.read());
-  DATA &= ~0x0003;
-  return DATA;
+  shtStart = millis();
 }
 
-void SCKAmbient::getSHT21()
+byte SCKAmbient::collectSHT21(uint16_t *data)
 {
-  lastTemperature = readSHT21(0xE3);  // RAW DATA for calibration in platform
-  lastHumidity    = readSHT21(0xE5);  // RAW DATA for calibration in platform
+  // No hold master: the SHT21 doesn't acknowledge the read until the conversion is done
+  if (Wire.requestFrom(Temperature, 3) < 3) return SHT21_BUSY;
+  byte DATA[2];
+  DATA[0] = Wire.read();
+  DATA[1] = Wire.read();
+  if (crcSHT21(DATA, 2) != Wire.read()) {
 #if debugAmbient
-  Serial.print("SHT21:  ");
-  Serial.print("Temperature: ");
-  Serial.print(lastTemperature / 10.);
-  Serial.print(" C, Humidity: ");
-  Serial.print(lastHumidity / 10.);
-  Serial.println(" %");
+    Serial.println("SHT21: CRC error");
 #endif
+    return SHT21_CRC;
+  }
+  *data = ((DATA[0] << 8) | DATA[1]) & ~0x0003;
+  return SHT21_OK;
+}
+
+byte SCKAmbient::crcSHT21(byte *data, byte len)
+{
+  // CRC-8, polynomial x^8 + x^5 + x^4 + 1 (0x131), initial value 0
+  byte crc = 0;
+  for (byte i = 0; i < len; i++) {
+    crc ^= data[i];
+    for (byte j = 0; j < 8; j++) {
+      if (crc & 0x80) crc = (crc << 1) ^ 0x31;
+      else crc = (crc << 1);
+    }
+  }
+  return crc;
+}
+
+void SCKAmbient::setSHT21(byte resolution)
+{
+  // User register: resolution in bits 7 and 0, the other bits must be kept
+  Wire.beginTransmission(Temperature);
+  Wire.write(0xE7);
+  Wire.endTransmission();
+  if (Wire.requestFrom(Temperature, 1) < 1) return;
+  byte reg = Wire.read();
+  reg = (reg & 0x7E) | (resolution & 0x01) | ((resolution & 0x02) << 6);
+  Wire.beginTransmission(Temperature);
+  Wire.write(0xE6);
+  Wire.write(reg);
+  Wire.endTransmission();
+  shtResolution = resolution;
+}
+
+void SCKAmbient::getSHT21()
+{
+  runTasks(_BV(TASK_CLIMATE));
 }
 
 void SCKAmbient::writeADXL(byte address, byte val)
@@ -435,8 +621,7 @@ void SCKAmbient::readADXL(byte address, int num, byte buff[])
   Wire.write(address);              //writes address to read from
   Wire.endTransmission();           //end transmission
 
-  Wire.beginTransmission(ADXL);     //start transmission to device
-  Wire.requestFrom(ADXL, num);      // request 6 bytes from device
+  Wire.requestFrom(ADXL, num);      // request num bytes from device
 
   int i = 0;
   unsigned long time = millis();
@@ -450,38 +635,58 @@ void SCKAmbient::readADXL(byte address, int num, byte buff[])
     buff[i] = Wire.read();           // read a byte
     i++;
   }
-  Wire.endTransmission();            //end transmission
 }
 
 void SCKAmbient::averageADXL()
 {
 #define lim 512
-  int temp_x = 0;
-  int temp_y = 0;
-  int temp_z = 0;
-  int lecturas = 10;
+  // Drains the FIFO (stream mode, up to 32 samples at 100Hz). Every 6 byte read of the
+  // data registers pops one entry, so that is one transaction per sample.
   byte buffADXL[6] ;    //6 bytes buffer for saving data read from the device
-  accel_x = 0;
-  accel_y = 0;
-  accel_z = 0;
-
-  for (int i = 0; i < lecturas; i++) {
-    readADXL(0x32, 6, buffADXL); //read the acceleration data from the ADXL345
-    temp_x = (((int)buffADXL[1]) << 8) | buffADXL[0];
-    temp_x = map(temp_x, -lim, lim, 0, 1023);
-    temp_y = (((int)buffADXL[3]) << 8) | buffADXL[2];
-    temp_y = map(temp_y, -lim, lim, 0, 1023);
-    temp_z = (((int)buffADXL[5]) << 8) | buffADXL[4];
-    temp_z = map(temp_z, -lim, lim, 0, 1023);
-    accel_x = (int)(temp_x + accel_x);
-    accel_y = (int)(temp_y + accel_y);
-    accel_z = (int)(temp_z + accel_z);
-  }
-  accel_x = (int)(accel_x / lecturas);
-  accel_y = (int)(accel_y / lecturas);
-  accel_z = (int)(accel_z / lecturas);
+  readADXL(ADXL_FIFO_STATUS, 1, buffADXL);
+  byte entries = buffADXL[0] & 0x3F;
+  if (entries == 0) return;
+  long sum[3] = {0, 0, 0};
+#if VIBRATION
+  // The burst is summed up while it is drained, nothing of it is kept
+  uint32_t square[3] = {0, 0, 0};  // |x| < 4096 in every range, 32 squares fit
+  int16_t lo[3];
+  int16_t hi[3];
+  int16_t last[3];
+  byte crossings[3] = {0, 0, 0};   // Around the mean of the previous burst
+  if (entries > ADXL_FIFO_SIZE) entries = ADXL_FIFO_SIZE;
+#endif
+  for (byte i = 0; i < entries; i++) {
+    readADXL(ADXL_DATA, 6, buffADXL); //read the acceleration data from the ADXL345
+    for (byte a = 0; a < 3; a++) {
+      int16_t x = (int16_t)((((int)buffADXL[2 * a + 1]) << 8) | buffADXL[2 * a]);
+      sum[a] += x;
+#if VIBRATION
+      square[a] += (int32_t)x * x;
+      if (i == 0) {
+        lo[a] = x;
+        hi[a] = x;
+        if (!vibMeanOk) vibMean[a] = x;
+      }
+      else if ((x >= vibMean[a]) != (last[a] >= vibMean[a])) crossings[a]++;
+      if (x < lo[a]) lo[a] = x;
+      if (x > hi[a]) hi[a] = x;
+      last[a] = x;
+#endif
+    }
+  }
+  // Same 0-1023 scale as map(x, -lim, lim, 0, 1023), applied once to the mean
+  accel_x = ((sum[0] / entries + lim) * 1023) / (2 * lim);
+  accel_y = ((sum[1] / entries + lim) * 1023) / (2 * lim);
+  accel_z = ((sum[2] / entries + lim) * 1023) / (2 * lim);
+#if VIBRATION
+  vibration(entries, sum, square, lo, hi, crossings);
+#endif
 
 #if debugAmbient
+  Serial.print("ADXL samples= ");
+  Serial.print(entries);
+  Serial.print(", ");
   Serial.print("x_axis= ");
   Serial.print(accel_x);
   Serial.print(", ");
@@ -492,19 +697,133 @@ void SCKAmbient::averageADXL()
   Serial.println(accel_z);
 #endif
 }
+
+#if VIBRATION
+// Burst features: RMS and peak around the mean, dominant frequency from the zero crossings
+// of the strongest axis, and tilt of the mean against the mounting position
+void SCKAmbient::vibration(byte entries, long *sum, uint32_t *square, int16_t *lo, int16_t *hi, byte *crossings)
+{
+  long mean[3];
+  float energy[3];
+  long peak = 0;
+  byte axis = 0;
+  for (byte a = 0; a < 3; a++) {
+    mean[a] = sum[a] / entries;
+    energy[a] = square[a] - (float)sum[a] * sum[a] / entries;
+    if (energy[a] < 0) energy[a] = 0;
+    if (hi[a] - mean[a] > peak) peak = hi[a] - mean[a];
+    if (mean[a] - lo[a] > peak) peak = mean[a] - lo[a];
+    if (energy[a] > energy[axis]) axis = a;
+    vibMean[a] = mean[a];
+  }
+  vibMeanOk = true;
+  long rms = sqrt((energy[0] + energy[1] + energy[2]) / entries) * ADXL_MG_X10 / 10;
+  if (rms >= vibRms) {
+    vibRms = rms;
+    vibFreq = ((long)crossings[axis] * ADXL_HZ) / (2 * entries);
+  }
+  peak = peak * ADXL_MG_X10 / 10;
+  if (peak > vibPeak) vibPeak = peak;
+
+  if (!tiltRefOk) {
+    for (byte a = 0; a < 3; a++) tiltRef[a] = mean[a];
+    tiltRefOk = true;
+  }
+  float dot = 0;
+  float norm = 0;
+  float normRef = 0;
+  for (byte a = 0; a < 3; a++) {
+    dot += (float)mean[a] * tiltRef[a];
+    norm += (float)mean[a] * mean[a];
+    normRef += (float)tiltRef[a] * tiltRef[a];
+  }
+  long last = tilt;
+  if ((norm > 0) && (normRef > 0)) tilt = acos(constrain(dot / sqrt(norm * normRef), -1, 1)) * 180 / PI;
+  if ((tilt >= ADXL_TILT_LIMIT) && (last < ADXL_TILT_LIMIT)) tamper = true;
+}
+
+// The activity latch (INT_SOURCE) is polled, INT1 doesn't reach a free interrupt pin.
+// A burst is drained at once so the vibration features catch the event.
+void SCKAmbient::pollADXL()
+{
+  if ((millis() - timeADXL) < ADXL_POLL) return;
+  timeADXL = millis();
+  byte source;
+  readADXL(ADXL_INT_SOURCE, 1, &source);
+  if (!(source & ADXL_ACTIVITY)) return;
+  activityCount++;
+  averageADXL();
+}
+#endif
 #else
 uint8_t bits[5];  // buffer to receive data
 
-#define TIMEOUT 10000
+// DHT22 frame decoded in the background: IO3 (PB6) raises PCINT6 on every change.
+// After the response (falling edges 0 and 1) each bit ends on a falling edge, and
+// the time between two falling edges is 50us low + 26us (0) or 70us (1) high.
+// The ADC is paused during the frame so its interrupt doesn't delay the timestamps, and
+// a bit too close to the threshold (or out of range) spoils the frame even if the
+// checksum happens to match.
+volatile byte dhtEdges = 0;
+volatile unsigned long dhtLast = 0;
+volatile boolean dhtDone = false;
+volatile boolean dhtDoubt = false;
+
+ISR(PCINT0_vect)
+{
+  if (PINB & _BV(PB6)) return;                     // Falling edges only
+  unsigned long now = micros();
+  byte n = dhtEdges;
+  if ((n >= 2) && (n < DHT_EDGES)) {
+    byte i = n - 2;
+    unsigned long width = now - dhtLast;
+    if (width > DHT_BIT_THRESHOLD) bits[i >> 3] |= (0x80 >> (i & 0x07));
+    if ((width < DHT_BIT_MIN) || (width > DHT_BIT_MAX) || ((width > DHT_BIT_THRESHOLD - DHT_BIT_MARGIN) && (width < DHT_BIT_THRESHOLD + DHT_BIT_MARGIN))) dhtDoubt = true;
+  }
+  dhtLast = now;
+  if (++n >= DHT_EDGES) {
+    dhtDone = true;
+    PCMSK0 &= ~_BV(PCINT6);
+  }
+  dhtEdges = n;
+}
+
+void SCKAmbient::DhtStart(uint8_t pin)
+{
+  // request the sensor, DhtListen() must follow after DHT_START_WAIT
+  PCMSK0 &= ~_BV(PCINT6);
+  pinMode(pin, OUTPUT);
+  digitalWrite(pin, LOW);
+}
+
+void SCKAmbient::DhtListen(uint8_t pin)
+{
+  for (int i = 0; i < 5; i++) bits[i] = 0;
+  dhtEdges = 0;
+  dhtDone = false;
+  dhtDoubt = false;
+  _base.adcPause();
+  PCMSK0 |= _BV(PCINT6);
+  PCIFR = _BV(PCIF0);
+  PCICR |= _BV(PCIE0);
+  digitalWrite(pin, HIGH);
+  pinMode(pin, INPUT);
+}
+
+boolean SCKAmbient::DhtReady()
+{
+  return dhtDone;
+}
 
 boolean SCKAmbient::getDHT22()
 {
   // Read Values
-  int rv = DhtRead(IO3);
-  if (rv != true) {
+  PCMSK0 &= ~_BV(PCINT6);
+  _base.adcResume();
+  if (!DhtReady() || dhtDoubt) {
     lastHumidity    = DHTLIB_INVALID_VALUE;  // invalid value, or is NaN prefered?
     lastTemperature = DHTLIB_INVALID_VALUE;  // invalid value
-    return rv;
+    return false;
   }
 
   // Convert and Store
@@ -523,75 +842,61 @@ boolean SCKAmbient::getDHT22()
   uint8_t sum = bits[0] + bits[1] + bits[2] + bits[3];
   if (bits[4] != sum) return false;
   if ((lastTemperature == 0) && (lastHumidity == 0))return false;
+  if ((lastHumidity > 1000) || (lastTemperature < -400) || (lastTemperature > 800)) return false; // Out of the DHT22 range
   return true;
 }
+#endif
 
-boolean SCKAmbient::DhtRead(uint8_t pin)
-{
-  // init Buffer to receive data
-  uint8_t cnt = 7;
-  uint8_t idx = 0;
-
-  // empty the buffer
-  for (int i = 0; i < 5; i++) bits[i] = 0;
-
-  // request the sensor
-  pinMode(pin, OUTPUT);
-  digitalWrite(pin, LOW);
-  delay(20);
-  digitalWrite(pin, HIGH);
-  delayMicroseconds(40);
-  pinMode(pin, INPUT);
-
-  // get ACK or timeout
-  unsigned int loopCnt = TIMEOUT;
-  while (digitalRead(pin) == LOW)
-    if (loopCnt-- == 0) return false;
-
-  loopCnt = TIMEOUT;
-  while (digitalRead(pin) == HIGH)
-    if (loopCnt-- == 0) return false;
+#if F_CPU == 8000000
+// Integration time register and gain code of every range, from the least sensitive one
+static const uint8_t BH1730_TIME[BH1730_RANGES] = {0xFC, 0xDA, 0xDA, 0xDA, 0xDA, 0x6C};
+static const uint8_t BH1730_GAIN[BH1730_RANGES] = {0x00, 0x00, 0x01, 0x02, 0x03, 0x03};
 
-  // read Ouput - 40 bits => 5 bytes
-  for (int i = 0; i < 40; i++) {
-    loopCnt = TIMEOUT;
-    while (digitalRead(pin) == LOW)
-      if (loopCnt-- == 0) return false;
+// Counts of a range relative to the others: gain x integration cycles
+static uint32_t lightSensitivity(byte range)
+{
+  uint32_t gain = 1;
+  if (BH1730_GAIN[range] == 0x01) gain = 2;
+  else if (BH1730_GAIN[range] == 0x02) gain = 64;
+  else if (BH1730_GAIN[range] == 0x03) gain = 128;
+  return gain * (256 - BH1730_TIME[range]);
+}
 
-    unsigned long t = micros();
+// ms of the integration of a range
+static uint16_t lightTime(byte range)
+{
+  return ((256 - BH1730_TIME[range]) * 27) / 10 + 1;
+}
 
-    loopCnt = TIMEOUT;
-    while (digitalRead(pin) == HIGH)
-      if (loopCnt-- == 0) return false;
+void SCKAmbient::startLight()
+{
+  lightUsed = lightRange;
+  uint8_t DATA [8] = {BH1730_ONE_SHOT, BH1730_TIME[lightUsed], 0x00 , 0x00, 0x00, 0xFF, 0xFF , BH1730_GAIN[lightUsed]} ;
 
-    if ((micros() - t) > 40) bits[idx] |= (1 << cnt);
-    if (cnt == 0) {
-      // next byte?
-      cnt = 7;
-      idx++;
-    }
-    else cnt--;
-  }
+  Wire.beginTransmission(bh1730);
+  Wire.write(0x80 | 0x00);
+  for (int i = 0; i < 8; i++) Wire.write(DATA[i]);
+  Wire.endTransmission();
+  lightStart = millis();
+}
 
-  return true;
+boolean SCKAmbient::lightValid()
+{
+  Wire.beginTransmission(bh1730);
+  Wire.write(0x80 | 0x00);
+  Wire.endTransmission();
+  Wire.requestFrom(bh1730, 1);
+  return (Wire.read() & BH1730_VALID);
 }
-#endif
 
-uint16_t SCKAmbient::getLight()
+uint32_t SCKAmbient::collectLight()
 {
-#if F_CPU == 8000000
-  uint8_t TIME0  = 0xDA;
-  uint8_t GAIN0 = 0x00;
-  uint8_t DATA [8] = {0x03, TIME0, 0x00 , 0x00, 0x00, 0xFF, 0xFF , GAIN0} ;
+  uint8_t TIME0  = BH1730_TIME[lightUsed];
+  uint8_t GAIN0 = BH1730_GAIN[lightUsed];
 
   uint16_t DATA0 = 0;
   uint16_t DATA1 = 0;
 
-  Wire.beginTransmission(bh1730);
-  Wire.write(0x80 | 0x00);
-  for (int i = 0; i < 8; i++) Wire.write(DATA[i]);
-  Wire.endTransmission();
-  delay(100);
   Wire.beginTransmission(bh1730);
   Wire.write(0x94);
   Wire.endTransmission();
@@ -601,6 +906,20 @@ uint16_t SCKAmbient::getLight()
   DATA1 = Wire.read();
   DATA1 = DATA1 | (Wire.read() << 8);
 
+  // Next range from these counts: the most sensitive one that keeps both channels under BH1730_TARGET
+  uint16_t counts = max(DATA0, DATA1);
+  if (counts >= BH1730_SATURATED) lightRange = 0;
+  else {
+    lightRange = 0;
+    uint32_t sens = lightSensitivity(lightUsed);
+    for (byte i = BH1730_RANGES - 1; i > 0; i--) {
+      if (((uint32_t)counts * lightSensitivity(i)) / sens < BH1730_TARGET) {
+        lightRange = i;
+        break;
+      }
+    }
+  }
+
   uint8_t Gain = 0x00;
   if (GAIN0 == 0x00) Gain = 1;
   else if (GAIN0 == 0x01) Gain = 2;
@@ -619,32 +938,92 @@ uint16_t SCKAmbient::getLight()
   else if (comp < 1.09) Lx = ( 0.510 * DATA0 - 0.345 * DATA1 ) / cons;
   else if (comp < 2.13) Lx = ( 0.276 * DATA0 - 0.130 * DATA1 ) / cons;
   else Lx = 0;
+  if (Lx < 0) Lx = 0;
 
 #if debugAmbient
   Serial.print("BH1730: ");
   Serial.print(Lx);
-  Serial.println(" Lx");
+  Serial.print(" Lx, range ");
+  Serial.print(lightUsed);
+  Serial.print(" -> ");
+  Serial.println(lightRange);
 #endif
   return Lx * 10;
-#else
-  int temp = map(_base.average(S5), 0, 1023, 0, 1000);
-  if (temp > 1000) temp = 1000;
-  if (temp < 0) temp = 0;
-  return temp;
+}
 #endif
+
+uint32_t SCKAmbient::getLight()
+{
+  runTasks(_BV(TASK_LIGHT));
+  return lastLight;
 }
 
-unsigned int SCKAmbient::getNoise()
+// mV referred to MIC_GAIN_MAX, so a gain change is no step in the readings
+unsigned long SCKAmbient::getNoise()
 {
 #if F_CPU == 8000000
-#define GAIN 10000
-  writeGAIN(GAIN);
-  delay(100);
+  writeGAIN(micGain);
 #endif
   float mVRaw = (float)((_base.average(S4)) / 1023.) * Vcc;
-  float dB = 0;
+  _base.noise().setVcc(Vcc);
+#if F_CPU == 8000000
+  return mVRaw * (MIC_GAIN_MAX / micGain);
+#else
   return mVRaw;
+#endif
+}
+
+#if F_CPU == 8000000
+void SCKAmbient::rangeNoise()
+{
+  // The gain for the next interval comes from the peak of the last one
+  uint16_t peak = _base.noise().takePeak();
+  long gain = micGain;
+  if ((peak > MIC_GAIN_HIGH) && (gain > MIC_GAIN_MIN)) gain = gain / 10;
+  else if ((peak < MIC_GAIN_LOW) && (gain < MIC_GAIN_MAX)) gain = gain * 10;
+  if (gain == micGain) return;
+  micGain = gain;
+  writeGAIN(micGain);
+  _base.noise().setGain(MIC_GAIN_MAX / micGain);
+  _base.noise().clear();
+  _base.noise().takePeak();
+#if debugAmbient
+  Serial.print("Microphone gain: ");
+  Serial.println(micGain);
+#endif
 }
+#endif
+
+#if NOISE_OCTAVES
+void SCKAmbient::getOctaves()
+{
+  int16_t burst[NOISE_FFT_SIZE];
+  uint32_t band[OCTAVE_BANDS];
+  float power[OCTAVE_BANDS];
+  byte bursts = 0;
+  for (byte i = 0; i < OCTAVE_BANDS; i++) power[i] = 0;
+  for (byte j = 0; j < NOISE_BURSTS; j++) {
+    _base.noise().capture(burst, NOISE_FFT_SIZE);
+    unsigned long start = millis();
+    while (!_base.noise().captured() && ((millis() - start) < 100));
+    if (!_base.noise().captured()) {
+      _base.noise().capture(0, 0);
+      break;
+    }
+    OctaveBands::analyse(burst, band);
+    for (byte i = 0; i < OCTAVE_BANDS; i++) power[i] += band[i];
+    bursts++;
+  }
+  // Hann window: x 8/3 so a full scale sine reads 0dBFS. A full scale sine is 511 counts of
+  // amplitude, x16 before the FFT, so its band reads 8184^2 at the output
+  for (byte i = 0; i < OCTAVE_BANDS; i++) {
+    float temp = (bursts > 0) ? power[i] * 8 / 3 / bursts / (8184. * 8184.) : 0;
+    if (temp > 0) value[VALUE_OCTAVE + i] = 100 * log10(temp);
+    else value[VALUE_OCTAVE + i] = NOISE_OCTAVE_MIN;
+    if (value[VALUE_OCTAVE + i] < NOISE_OCTAVE_MIN) value[VALUE_OCTAVE + i] = NOISE_OCTAVE_MIN;
+  }
+}
+#endif
 
 unsigned long SCKAmbient::getCO()
 {
@@ -678,68 +1057,526 @@ int SCKAmbient::getHumidity()
 }
 #endif
 
-void SCKAmbient::updateSensors(byte mode)
+void SCKAmbient::runTasks(byte tasks)
 {
-  boolean ok_read = false;
-  byte    retry   = 0;
+  // Starts every task and collects each one when its wait is over, so the
+  // conversions of the different sensors overlap instead of adding up
+  unsigned long start = millis();
+  for (byte i = 0; i < TASKS; i++) {
+    taskStage[i] = 0;
+    taskAt[i] = start;
+  }
+  while (tasks) {
+    if ((millis() - start) > TASK_TIMEOUT) {
+      if (analogBusy) _base.adcReference(DEFAULT);
+      analogBusy = false;
+      _base.adcResume();   // A DHT22 frame may have been left listening
+#if debugAmbient
+      Serial.print("Tasks dropped: ");
+      Serial.println(tasks, BIN);
+#endif
+      break;
+    }
+    heaterTick();
+    _base.noise().process();
+    for (byte i = 0; i < TASKS; i++) {
+      if (!(tasks & _BV(i))) continue;
+      if ((long)(millis() - taskAt[i]) < 0) continue;
+      long wait = stepTask(i);
+      if (wait == TASK_END) tasks &= ~_BV(i);
+      else taskAt[i] = millis() + wait;
+    }
+  }
+}
+
+long SCKAmbient::stepTask(byte task)
+{
+  if (task == TASK_CLIMATE) return stepClimate(taskStage[task]);
+  else if (task == TASK_LIGHT) return stepLight(taskStage[task]);
+  else if (task == TASK_GAS) return stepGas(taskStage[task]);
+  return stepAnalog(taskStage[task]);
+}
 
+long SCKAmbient::stepClimate(byte &stage)
+{
 #if F_CPU == 8000000
-  getSHT21();
-  ok_read = true;
+  uint16_t DATA = 0;
+  byte status = SHT21_BUSY;
+  if (stage == 0) {
+    climateOk = false;
+    shtErrors = 0;
+    byte resolution = _base.readData(EE_ADDR_SHT21_RESOLUTION, INTERNAL);
+    if (resolution != shtResolution) setSHT21(resolution);
+    stage = 1;
+  }
+  if (stage == 1) {
+    startSHT21(0xF3);
+    stage = 2;
+    return SHT21_TEMP_WAIT[shtResolution];
+  }
+  else if (stage == 2) {
+    status = collectSHT21(&DATA);
+    // Absent or hung, the SHT21 never acknowledges: given up after twice the conversion time
+    if (status == SHT21_BUSY) return ((millis() - shtStart) < 2UL * SHT21_TEMP_WAIT[shtResolution] + SHT21_SLACK) ? TASK_POLL : TASK_END;
+    if (status == SHT21_CRC) {
+      if (++shtErrors > SHT21_RETRIES) return TASK_END;
+      stage = 1;
+      return 0;
+    }
+    lastTemperature = DATA;  // RAW DATA for calibration in platform
+    startSHT21(0xF5);
+    stage = 3;
+    return SHT21_HUM_WAIT[shtResolution];
+  }
+  status = collectSHT21(&DATA);
+  if (status == SHT21_BUSY) return ((millis() - shtStart) < 2UL * SHT21_HUM_WAIT[shtResolution] + SHT21_SLACK) ? TASK_POLL : TASK_END;
+  if (status == SHT21_CRC) {
+    if (++shtErrors > SHT21_RETRIES) return TASK_END;
+    startSHT21(0xF5);
+    return SHT21_HUM_WAIT[shtResolution];
+  }
+  lastHumidity = DATA;       // RAW DATA for calibration in platform
+  climateOk = true;
+#if debugAmbient
+  Serial.print("SHT21:  ");
+  Serial.print("Temperature: ");
+  Serial.print(lastTemperature / 10.);
+  Serial.print(" C, Humidity: ");
+  Serial.print(lastHumidity / 10.);
+  Serial.println(" %");
+#endif
+  return TASK_END;
 #else
-  _base.timer1Stop();
-  while ((!ok_read) && (retry < 5))
-  {
-    ok_read = getDHT22();
-    retry++;
-    if (!ok_read)delay(3000);
+  // stage = attempt x 3 + step, the serial console keeps running meanwhile
+  byte step = stage % 3;
+  stage++;
+  if (step == 0) {
+    DhtStart(IO3);
+    return DHT_START_WAIT;
   }
-  _base.timer1Initialize();
+  else if (step == 1) {
+    DhtListen(IO3);
+    return DHT_FRAME_WAIT;
+  }
+  climateOk = getDHT22();
+  if (climateOk || ((stage / 3) >= DHT_RETRIES)) return TASK_END;
+  return DHT_RETRY_WAIT;
 #endif
-  if (((millis() - timeMICS) <= 6 * minute) || (mode != ECONOMIC)) {
-    //6 minutes
+}
+
+long SCKAmbient::stepLight(byte &stage)
+{
 #if F_CPU == 8000000
-    getVcc();
-#endif
-    getMICS();
-    value[5] = getCO(); //ppm
-    value[6] = getNO2(); //ppm
-  }
-  else if ((millis() - timeMICS) >= 60 * minute) {
-    GasSensor(true);
-    timeMICS = millis();
+  if (stage == 0) {
+    startLight();
+    stage = 1;
+    return lightTime(lightUsed);
   }
-  else {
-    GasSensor(false);
+  // The valid bit ends the wait, the conversion takes a little longer than the integration
+  if (!lightValid() && ((millis() - lightStart) < 2UL * lightTime(lightUsed) + BH1730_SLACK)) return TASK_POLL;
+  uint32_t light = collectLight();
+  if ((lightRange != lightUsed) && (lightRetry < BH1730_RETRIES)) {
+    // Saturated or far off range: measured again at once with the new range
+    lightRetry++;
+    stage = 0;
+    return 0;
   }
+  lightRetry = 0;
+  lastLight = light;
+#else
+  int temp = map(_base.average(S5), 0, 1023, 0, 1000);
+  if (temp > 1000) temp = 1000;
+  if (temp < 0) temp = 0;
+  lastLight = temp;
+#endif
+  return TASK_END;
+}
 
-  if (ok_read) {
-#if ((decouplerComp)&&(F_CPU > 8000000 ))
-    uint16_t battery = _base.getBattery(Vcc);
-    decoupler.update(battery);
-    value[0] = getTemperature() - (int) decoupler.getCompensation();
+long SCKAmbient::stepGas(byte &stage)
+{
+  if (stage == 0) {
+#if F_CPU == 8000000
+    // Vcc from the ratio of S3 against the default and the internal (2.56V) references
+    vccDefault = _base.average(S3);
+    analogBusy = true;
+    _base.adcReference(INTERNAL);
+    stage = 1;
+    return TASK_POLL;
 #else
-    value[0] = getTemperature();
+    stage = 3;
 #endif
-    value[1] = getHumidity();
   }
-  else {
-    value[0] = 0; // ºC
-    value[1] = 0; // %
+  if (stage == 1) {
+    if (!_base.adcReady(S3)) return TASK_POLL;
+    Vcc = (float)(_base.average(S3) / vccDefault) * reference;
+    _base.adcReference(DEFAULT);
+    stage = 2;
+    return TASK_POLL;
+  }
+  if (stage == 2) {
+    if (!_base.adcReady(S3)) return TASK_POLL;
+    analogBusy = false;
+    stage = 3;
   }
-  value[2] = getLight(); //mV
+  if (stage == 3) {
+    // Charging tension heaters
+    heat(MICS_5525, 32); //Corriente en mA
+    heat(MICS_2710, 26); //Corriente en mA
+    heatStart = millis();
+    stage = 4;
+    return HEATER_TICK;
+  }
+  if (stage == 4) {
+    // Read as soon as both currents hold, or after HEATER_SETTLE_MAX anyway
+    if (!heaterSettled() && ((millis() - heatStart) < HEATER_SETTLE_MAX)) return TASK_POLL;
+    micsRange = 0;
+    micsSteps = 0;
+    if (rangeMICS(MICS_5525, true)) micsRange |= _BV(MICS_5525);
+    if (rangeMICS(MICS_2710, true)) micsRange |= _BV(MICS_2710);
+    stage = 5;
+    if (micsRange) return MICS_SETTLE;
+  }
+  if (stage == 5) {
+    for (byte device = MICS_5525; device <= MICS_2710; device++) {
+      if ((micsRange & _BV(device)) && !rangeMICS(device, false)) micsRange &= ~_BV(device);
+    }
+    if (micsRange && (++micsSteps < MICS_RANGE_STEPS)) return MICS_SETTLE;
+  }
+  RsCO = readRs(MICS_5525);
+  RsNO2 = readRs(MICS_2710);
+  return TASK_END;
+}
+
+long SCKAmbient::stepAnalog(byte &)
+{
+  if (analogBusy) return TASK_POLL;
   value[3] = _base.getBattery(Vcc); //%
   value[4] = _base.getPanel(Vcc);  // %
   value[7] = getNoise(); //mV
+  _base.noise().report(&value[VALUE_LEQ], &value[VALUE_LMAX], &value[VALUE_L10], &value[VALUE_L90]); //dB x10
+#if F_CPU == 8000000
+  value[VALUE_GAIN] = micGain;
+#else
+  value[VALUE_GAIN] = 0;
+#endif
+#if NOISE_OCTAVES
+  getOctaves(); //dBFS x10
+#endif
+#if F_CPU == 8000000
+  rangeNoise();
+  averageADXL();
+#if VIBRATION
+  value[VALUE_VIBRATION] = vibRms; //mg
+  value[VALUE_VIBRATION + 1] = vibPeak; //mg
+  value[VALUE_VIBRATION + 2] = vibFreq; //Hz
+  value[VALUE_VIBRATION + 3] = tilt; //deg
+  value[VALUE_VIBRATION + 4] = activityCount;
+  vibRms = 0;
+  vibPeak = 0;
+  vibFreq = 0;
+  activityCount = 0;
+#endif
+#endif
+  return TASK_END;
+}
+
+void SCKAmbient::updateSensors(byte mode)
+{
+  // Channels with their own period were sampled by sampleTasks(), their latest value is posted
+  byte tasks = 0;
+  for (byte i = 0; i < TASKS; i++) {
+    if (period[i] == 0) tasks |= _BV(i);
+  }
+
+  if (mode != ECONOMIC) {
+    if (gasCycle == GAS_OFF) GasSensor(true);
+    gasCycle = GAS_ON;
+  }
+  else {
+    tasks &= ~_BV(TASK_GAS);
+    if ((gasCycle == GAS_ON) || ((gasCycle == GAS_OFF) && ((millis() - timeMICS) >= gasPeriod * minute))) {
+      // ECONOMIC: the gas reading is taken by warmGas() once the sensors are warm
+      GasSensor(true);
+      timeMICS = millis();
+      gasLastAt = millis();
+      gasLastCO = 0;
+      gasLastNO2 = 0;
+      gasStable = 0;
+      gasCycle = GAS_WARMING;
+    }
+  }
+
+  if ((millis() - timeMCP) >= MCP_VERIFY_PERIOD) {
+    _base.verifyMCP();
+    timeMCP = millis();
+  }
+
+  runTasks(tasks);
+  storeTasks(tasks);
+#if INTERVAL_STATS
+  reportStats();
+#endif
   if (mode == NOWIFI) {
     value[8] = 0;  //Wifi Nets
     _base.RTCtime(time);
   }
   else if (mode == OFFLINE) {
-    value[8] = _base.scan();  //Wifi Nets
+    _server->scan(value);  //Wifi Nets
     _base.RTCtime(time);
   }
 }
+
+// Copies the results of the tasks just run into value[]
+void SCKAmbient::storeTasks(byte tasks)
+{
+  if (tasks & _BV(TASK_GAS)) {
+    value[5] = getCO(); //ppm
+    value[6] = getNO2(); //ppm
+    gasFresh = true;
+  }
+  if (tasks & _BV(TASK_CLIMATE)) {
+    if (climateOk) {
+#if ((decouplerComp)&&(F_CPU > 8000000 ))
+      uint16_t battery = _base.getBattery(Vcc);
+      decoupler.update(battery);
+      value[0] = getTemperature() - (int) decoupler.getCompensation();
+#else
+      updateThermal();
+      value[0] = getTemperature() - thermalOffset();
+#endif
+      value[1] = getHumidity();
+    }
+    else {
+      value[0] = 0; // ºC
+      value[1] = 0; // %
+    }
+  }
+  if (tasks & _BV(TASK_LIGHT)) value[2] = lastLight; //mV
+}
+
+#if !((decouplerComp)&&(F_CPU > 8000000 ))
+// Feeds the thermal model with the heat of the last interval: the linear charger burns
+// (input - battery) x current, the radio its share of THERMAL_RADIO_POWER
+void SCKAmbient::updateThermal()
+{
+  unsigned long now = millis();
+  unsigned long dt = now - thermalAt;
+  uint32_t radio = _server->link().total;
+  uint32_t power = 0;
+  if (dt > 0) power = ((radio - thermalRadio) * (uint32_t)THERMAL_RADIO_POWER) / dt;
+  uint16_t input = _base.chargeInput(Vcc);
+  if (input > THERMAL_BATTERY) power += (_base.chargeCurrent(Vcc) * (input - THERMAL_BATTERY)) / 1000;
+  if (power > THERMAL_POWER_MAX) power = THERMAL_POWER_MAX;
+  thermal.update(power, dt);
+  thermalAt = now;
+  thermalRadio = radio;
+#if debugAmbient
+  Serial.print("Heat: ");
+  Serial.print(power);
+  Serial.print(" mW, rise: ");
+  Serial.print(thermal.getRise() / 100.);
+  Serial.println(" C");
+#endif
+}
+
+// Rise of the model in the units of getTemperature()
+long SCKAmbient::thermalOffset()
+{
+#if F_CPU == 8000000
+  return ((long)thermal.getRise() * 65536) / 17572;   // SHT21 raw, 175.72C over 16 bits
+#else
+  return thermal.getRise() / 10;                      // DHT22, 0.1C
+#endif
+}
+#endif
+
+// Runs the tasks whose own period is over, between two uploads
+void SCKAmbient::sampleTasks()
+{
+  byte tasks = 0;
+  for (byte i = 0; i < TASKS; i++) {
+    if ((period[i] > 0) && ((millis() - periodAt[i]) >= (unsigned long)period[i] * second)) {
+      tasks |= _BV(i);
+      periodAt[i] = millis();
+    }
+  }
+  if (sensor_mode == ECONOMIC) tasks &= ~_BV(TASK_GAS);   // warmGas() owns the gas readings
+  if (!tasks) return;
+  runTasks(tasks);
+  storeTasks(tasks);
+}
+
+void SCKAmbient::loadEvents()
+{
+  eventZscore = _base.readData(EE_ADDR_EVENT_ZSCORE, INTERNAL);
+  for (byte i = 0; i < EVENT_CHANNELS; i++) {
+    events[i].setup(_base.readData(EE_ADDR_EVENT_LEVEL + i * 4, INTERNAL), _base.readData(EE_ADDR_EVENT_RATE + i * 4, INTERNAL));
+  }
+}
+
+// Seconds between two readings
+uint32_t SCKAmbient::updateInterval()
+{
+  if ((adaptHigh > 0) && (adaptInterval > 0)) return adaptInterval;
+  return TimeUpdate;
+}
+
+// Halves the interval while the readings move more than adaptHigh per mille between two
+// readings (now or lately), doubles it while they move less than adaptLow
+void SCKAmbient::adapt()
+{
+  uint32_t activity = 0;
+  boolean compared = false;
+  for (byte i = 0; i < ADAPT_CHANNELS; i++) {
+    if (!climateOk && (ADAPT_VALUE[i] < 2)) continue;   // A failed reading is 0, not a change
+    long x = value[ADAPT_VALUE[i]];
+    if (adaptSeen & _BV(i)) {
+      long last = labs(adaptLast[i]);
+      if (last < ADAPT_FLOOR[i]) last = ADAPT_FLOOR[i];
+      uint32_t change = (float)labs(x - adaptLast[i]) * 1000 / last;
+      if (change > activity) activity = change;
+      compared = true;
+    }
+    adaptLast[i] = x;
+    adaptSeen |= _BV(i);
+  }
+  if (!compared) return;
+  adaptLevel = (3 * adaptLevel + activity) / 4;
+  if (adaptHigh == 0) {
+    adaptInterval = 0;
+    return;
+  }
+  uint32_t interval = updateInterval();
+  if ((activity >= adaptHigh) || (adaptLevel >= adaptHigh)) interval = interval / 2;
+  else if ((activity <= adaptLow) && (adaptLevel <= adaptLow)) interval = interval * 2;
+  if (interval < MIN_TIME_UPDATE) interval = MIN_TIME_UPDATE;
+  if (interval > MAX_TIME_UPDATE) interval = MAX_TIME_UPDATE;
+#if debugAmbient
+  if (interval != updateInterval()) {
+    Serial.print("Interval: ");
+    Serial.print(interval);
+    Serial.print(" s, change: ");
+    Serial.println(activity);
+  }
+#endif
+  adaptInterval = interval;
+}
+
+void SCKAmbient::loadPeriods()
+{
+  for (byte i = 0; i < PERIODS; i++) period[i] = _base.readData(EE_ADDR_PERIOD + i * 4, INTERNAL);
+}
+
+// Rs flat within GAS_STABLE_SLOPE per minute on both sensors, for GAS_STABLE_READINGS polls
+boolean SCKAmbient::gasWarmed()
+{
+  unsigned long now = millis();
+  float minutes = (float)(now - gasLastAt) / minute;
+  if ((gasLastCO > 0) && (gasLastNO2 > 0)
+      && (abs(RsCO - gasLastCO) <= GAS_STABLE_SLOPE * gasLastCO * minutes)
+      && (abs(RsNO2 - gasLastNO2) <= GAS_STABLE_SLOPE * gasLastNO2 * minutes)) gasStable++;
+  else gasStable = 0;
+  gasLastCO = RsCO;
+  gasLastNO2 = RsNO2;
+  gasLastAt = now;
+  if ((now - timeMICS) >= GAS_WARMUP_MAX) return true;
+  return (((now - timeMICS) >= GAS_WARMUP_MIN) && (gasStable >= GAS_STABLE_READINGS));
+}
+
+// ECONOMIC mode: polls the heating sensors, keeps the first warm reading and turns them off
+void SCKAmbient::warmGas()
+{
+  if ((sensor_mode != ECONOMIC) || (gasCycle != GAS_WARMING)) return;
+  if ((millis() - gasLastAt) < GAS_WARMUP_POLL) return;
+  runTasks(_BV(TASK_GAS));
+  if (!gasWarmed()) return;
+  value[5] = getCO(); //ppm
+  value[6] = getNO2(); //ppm
+  gasFresh = true;
+  GasSensor(false);
+  gasCycle = GAS_OFF;
+#if debugAmbient
+  Serial.print("MICS warm after ");
+  Serial.print((millis() - timeMICS) / second);
+  Serial.println(" s, heaters off");
+#endif
+}
+
+#if INTERVAL_STATS
+// Samples the cheap channels between two uploads, see reportStats()
+void SCKAmbient::sampleStats()
+{
+  if ((millis() - timeStats) < statsRate * second) return;
+  timeStats = millis();
+  runTasks(_BV(TASK_CLIMATE) | _BV(TASK_LIGHT));
+  if (climateOk) {
+#if ((decouplerComp)&&(F_CPU > 8000000 ))
+    stats[0].add(getTemperature() - (int) decoupler.getCompensation());
+#else
+    stats[0].add(getTemperature() - thermalOffset());
+#endif
+    stats[1].add(getHumidity());
+  }
+  stats[2].add(lastLight);
+  stats[3].add(_base.getBattery(Vcc));
+  stats[4].add(getNoise());
+}
+
+// Min, max, mean and stddev of every stats channel from VALUE_STATS, then a new interval
+void SCKAmbient::reportStats()
+{
+  for (byte i = 0; i < STATS_CHANNELS; i++) {
+    // The reading taken for the upload is one more sample
+    if (climateOk || (STATS_VALUE[i] > 1)) stats[i].add(value[STATS_VALUE[i]]);
+    long *v = &value[VALUE_STATS + 4 * i];
+    if (stats[i].count == 0) {
+      v[0] = 0;
+      v[1] = 0;
+      v[2] = 0;
+      v[3] = 0;
+    }
+    else {
+      v[0] = stats[i].minimum;
+      v[1] = stats[i].maximum;
+      v[2] = lround(stats[i].mean);
+      v[3] = lround(stats[i].stddev());
+    }
+    stats[i].clear();
+  }
+}
+#endif
+
+boolean SCKAmbient::checkEvents()
+{
+  boolean fired = false;
+  for (byte i = 0; i < EVENT_CHANNELS; i++) {
+    // With a gas period or in ECONOMIC, CO and NO2 are repeated between two gas readings:
+    // feeding the repeats would shrink the variance until the next real reading fires
+    if (((EVENT_VALUE[i] == 5) || (EVENT_VALUE[i] == 6)) && !gasFresh) continue;
+    if (events[i].update(value[EVENT_VALUE[i]], eventZscore)) {
+      fired = true;
+#if debugEnabled
+      if (!_base.getDebugState()) {
+        Serial.print(F("Event detected on "));
+        _base.printLabel(Serial, SENSOR, EVENT_VALUE[i]);
+        Serial.println();
+      }
+#endif
+    }
+  }
+  gasFresh = false;
+#if ((VIBRATION)&&(F_CPU == 8000000))
+  if (tamper) {
+    tamper = false;
+    fired = true;
+#if debugEnabled
+    if (!_base.getDebugState()) Serial.println(F("Tilt detected, the kit was moved"));
+#endif
+  }
+#endif
+  return fired;
+}
+
 /*
   boolean SCKAmbient::debug_state()
   {
@@ -748,6 +1585,12 @@ void SCKAmbient::updateSensors(byte mode)
 */
 void SCKAmbient::execute(boolean instant)
 {
+  if (postPending) {
+    postPending = false;
+    instant = true;
+  }
+  heaterTick();
+  _base.noise().process();   // A-weighting of the queued microphone samples
   if (terminal_mode) {                        // Telnet  (#data + *OPEN* detectado )
     sleep = false;
     digitalWrite(AWAKE, HIGH);
@@ -757,13 +1600,14 @@ void SCKAmbient::execute(boolean instant)
   }
 
   if (!RTCupdatedSinceBoot && !_base.RTCisValid(time)) {
+    if (!_server->link().allow()) return;                         // Backing off, don't wake the WiFly on every loop
     digitalWrite(AWAKE, HIGH);
 #if debugEnabled
     if (!_base.getDebugState()) Serial.println(F("RTC not updated!!!"));
     if (!_base.getDebugState()) Serial.println(F("With no valid time it's useless to take readings!!"));
     if (!_base.getDebugState()) Serial.println(F("Trying to get valid time..."));
 #endif
-    if (_base.connect()) {
+    if (_server->join()) {
 #if debugEnabled
       if (!_base.getDebugState()) Serial.println(F("SCK Connected to Wi-Fi!!"));
 #endif
@@ -782,6 +1626,7 @@ void SCKAmbient::execute(boolean instant)
         if (!_base.getDebugState()) Serial.println(F("RTC Update Failed!!"));
 #endif
       }
+      _server->leave(RTCupdatedSinceBoot);
     }
     else {
 #if debugEnabled
@@ -797,13 +1642,26 @@ void SCKAmbient::execute(boolean instant)
     }
   }
   else {
-    if ((millis() - timetransmit) >= (unsigned long)TimeUpdate * second || instant) {
+    if (!_base.getDebugState()) {
+      warmGas();
+#if ((VIBRATION)&&(F_CPU == 8000000))
+      pollADXL();
+#endif
+      sampleTasks();
+#if INTERVAL_STATS
+      sampleStats();
+#endif
+    }
+    if ((millis() - timetransmit) >= updateInterval() * second || instant) {
       if (!instant) timetransmit = millis();                         // Only reset timer if execute() is called by timer
       TimeUpdate = _base.readData(EE_ADDR_TIME_UPDATE, INTERNAL);    // Time between transmissions in sec.
       NumUpdates = _base.readData(EE_ADDR_NUMBER_UPDATES, INTERNAL); // Number of readings before batch update
       if (!_base.getDebugState()) {                                                // CMD Mode False
         updateSensors(sensor_mode);
-        if ((sensor_mode) > NOWIFI) _server->send(sleep, &wait_moment, value, time, instant);
+        value[VALUE_INTERVAL] = updateInterval(); //s
+        adapt();
+        boolean event = checkEvents();                               // An event posts at once, whatever the batch size
+        if ((sensor_mode) > NOWIFI) _server->send(sleep, &wait_moment, value, time, instant || event);
 #if USBEnabled
         txDebug();
 #endif
@@ -817,26 +1675,36 @@ void SCKAmbient::txDebug()
   if (!_base.getDebugState()) {
     Serial.println(F("*******************"));
     float dec = 0;
-    for (int i = 0; i < 9; i++) {
+    for (int i = 0; i < SENSORS; i++) {
+      int j = i;   // Channel whose scale applies
+#if INTERVAL_STATS
+      if (i >= VALUE_STATS) j = STATS_VALUE[(i - VALUE_STATS) / 4];
+#endif
 #if F_CPU == 8000000
-      if (i < 2) dec = 1;
-      else if (i < 4) dec = 10;
-      else if (i < 5) dec = 1;
-      else if (i < 7) dec = 1000;
-      else if (i < 8) dec = 1;
+      if (j < 2) dec = 1;
+      else if (j < 4) dec = 10;
+      else if (j < 5) dec = 1;
+      else if (j < 7) dec = 1000;
+      else if (j < 8) dec = 1;
 #else
-      if (i < 4) dec = 10;
-      else if (i < 5) dec = 1;
-      else if (i < 7) dec = 1000;
-      else if (i < 8) dec = 1;
+      if (j < 4) dec = 10;
+      else if (j < 5) dec = 1;
+      else if (j < 7) dec = 1000;
+      else if (j < 8) dec = 1;
 #endif
-      else dec = 1;
-      Serial.print(SENSOR[i]);
+      else if (j < VALUE_LEQ) dec = 1;
+      else if ((j == VALUE_GAIN) || (j == VALUE_INTERVAL)) dec = 1;
+#if ((VIBRATION)&&(F_CPU == 8000000))
+      else if ((j >= VALUE_VIBRATION) && (j < VALUE_VIBRATION + VIBRATION_VALUES)) dec = 1;
+#endif
+      else dec = 10;
+      _base.printLabel(Serial, SENSOR, i);
       if (dec > 1) Serial.print((float)(value[i] / dec));
-      else Serial.print((unsigned int)(value[i] / dec));
-      Serial.println(UNITS[i]);
+      else Serial.print(value[i]);
+      _base.printLabel(Serial, UNITS, i);
+      Serial.println();
     }
-    Serial.print(SENSOR[9]);
+    _base.printLabel(Serial, SENSOR, SENSORS);
     Serial.println(time);
     Serial.println(F("*******************"));
   }
@@ -966,6 +1834,73 @@ void SCKAmbient::serialRequests()
         else if (_base.checkText("time update", buffer_int)) Serial.println(_base.readData(EE_ADDR_TIME_UPDATE, INTERNAL));
         else if (_base.checkText("number updates", buffer_int)) Serial.println(_base.readData(EE_ADDR_NUMBER_UPDATES, INTERNAL));
         else if (_base.checkText("apikey", buffer_int)) Serial.println(_base.readData(EE_ADDR_APIKEY, 0, INTERNAL));
+        else if (_base.checkText("upload", buffer_int)) {
+          Serial.print(_base.readData(EE_ADDR_UPLOAD_BUDGET, INTERNAL));
+          Serial.print(F(" "));
+          Serial.print(_base.readData(EE_ADDR_UPLOAD_BYTES, INTERNAL));
+          Serial.print(F(" "));
+          if (_base.readData(EE_ADDR_UPLOAD_ORDER, INTERNAL) == UPLOAD_NEWEST) Serial.println(F("newest"));
+          else Serial.println(F("oldest"));
+        }
+        else if (_base.checkText("gas", buffer_int)) Serial.println(_base.readData(EE_ADDR_GAS_PERIOD, INTERNAL));
+#if INTERVAL_STATS
+        else if (_base.checkText("stats", buffer_int)) Serial.println(_base.readData(EE_ADDR_STATS_RATE, INTERNAL));
+#endif
+#if F_CPU == 8000000
+        else if (_base.checkText("sht21", buffer_int)) {
+          Serial.println(_base.readData(EE_ADDR_SHT21_RESOLUTION, INTERNAL));
+        }
+#endif
+        else if (_base.checkText("thin", buffer_int)) {
+          Serial.print(_base.readData(EE_ADDR_THIN_START, INTERNAL));
+          Serial.print(F(" "));
+          Serial.print(_base.readData(EE_ADDR_THIN_DEEP, INTERNAL));
+          Serial.print(F(" "));
+          Serial.println(_base.readData(EE_ADDR_THIN_WINDOW, INTERNAL));
+        }
+        else if (_base.checkText("radio", buffer_int)) {
+          Serial.print(_server->link().budget / second);
+          Serial.print(F(" "));
+          Serial.print(_server->link().used / second);
+          Serial.print(F(" "));
+          Serial.println(_server->link().failures);
+        }
+#if !((decouplerComp)&&(F_CPU > 8000000 ))
+        else if (_base.checkText("thermal", buffer_int)) {
+          Serial.print(thermal.tau);
+          Serial.print(F(" "));
+          Serial.println(thermal.getRise());
+        }
+#endif
+        else if (_base.checkText("adapt", buffer_int)) {
+          Serial.print(adaptLow);
+          Serial.print(F(" "));
+          Serial.print(adaptHigh);
+          Serial.print(F(" "));
+          Serial.println(updateInterval());
+        }
+        else if (_base.checkText("period", buffer_int)) {
+          for (byte i = 0; i < PERIODS; i++) {
+            Serial.print(PERIOD_NAME[i]);
+            Serial.println(period[i]);
+          }
+        }
+        else if (_base.checkText("filter", buffer_int)) {
+          for (byte i = 0; i < ADC_CHANNELS; i++) {
+            Serial.print(FILTER_NAME[i]);
+            Serial.println(_base.adcFilter(i));
+          }
+        }
+        else if (_base.checkText("event", buffer_int)) {
+          Serial.print(F("zscore "));
+          Serial.println(eventZscore);
+          for (byte i = 0; i < EVENT_CHANNELS; i++) {
+            Serial.print(EVENT_NAME[i]);
+            Serial.print(events[i].level);
+            Serial.print(F(" "));
+            Serial.println(events[i].rate);
+          }
+        }
         else if (_base.checkText("all", buffer_int)) {
           Serial.print(F("|"));
           Serial.print(FirmWare);
@@ -989,7 +1924,7 @@ void SCKAmbient::serialRequests()
         }
       }
       else if (_base.checkText("post data\r", buffer_int)) {
-        execute(true);
+        postPending = true;   // The acquisition tasks must not run inside this interrupt
       }
       /*Write commands*/
       else if (_base.checkText("set ", buffer_int)) {
@@ -1015,6 +1950,119 @@ void SCKAmbient::serialRequests()
           //eeprom_write_ok = true;
           //address_eeprom = EE_ADDR_APIKEY; //and what next ?
         }
+        else if (_base.checkText("upload ", buffer_int)) {
+          if (_base.checkText("budget ", buffer_int)) {
+            uint32_t budget = atol(buffer_int);
+            if (budget <= MAX_TIME_UPDATE) _base.writeData(EE_ADDR_UPLOAD_BUDGET, budget, INTERNAL);
+          }
+          else if (_base.checkText("bytes ", buffer_int)) _base.writeData(EE_ADDR_UPLOAD_BYTES, atol(buffer_int), INTERNAL);
+          else if (_base.checkText("order newest", buffer_int)) _base.writeData(EE_ADDR_UPLOAD_ORDER, UPLOAD_NEWEST, INTERNAL);
+          else if (_base.checkText("order oldest", buffer_int)) _base.writeData(EE_ADDR_UPLOAD_ORDER, UPLOAD_OLDEST, INTERNAL);
+        }
+        else if (_base.checkText("gas period ", buffer_int)) {
+          uint32_t temp = atol(buffer_int);
+          if ((temp >= GAS_PERIOD_MIN) && (temp <= GAS_PERIOD_MAX)) {
+            _base.writeData(EE_ADDR_GAS_PERIOD, temp, INTERNAL);
+            gasPeriod = temp;
+          }
+        }
+#if INTERVAL_STATS
+        else if (_base.checkText("stats rate ", buffer_int)) {
+          uint32_t temp = atol(buffer_int);
+          if ((temp >= STATS_RATE_MIN) && (temp <= STATS_RATE_MAX)) {
+            _base.writeData(EE_ADDR_STATS_RATE, temp, INTERNAL);
+            statsRate = temp;
+          }
+        }
+#endif
+#if F_CPU == 8000000
+        else if (_base.checkText("sht21 resolution ", buffer_int)) {
+          uint32_t temp = atol(buffer_int);
+          if (temp <= SHT21_RES_MAX) _base.writeData(EE_ADDR_SHT21_RESOLUTION, temp, INTERNAL); // Applied at the next reading
+        }
+#endif
+        else if (_base.checkText("thin ", buffer_int)) {
+          if (_base.checkText("start ", buffer_int)) {
+            uint32_t temp = atol(buffer_int);
+            if (temp <= 100) _base.writeData(EE_ADDR_THIN_START, temp, INTERNAL);
+          }
+          else if (_base.checkText("deep ", buffer_int)) {
+            uint32_t temp = atol(buffer_int);
+            if (temp <= 100) _base.writeData(EE_ADDR_THIN_DEEP, temp, INTERNAL);
+          }
+          else if (_base.checkText("window ", buffer_int)) {
+            uint32_t temp = atol(buffer_int);
+            if ((temp >= 4) && (temp <= FIFO_THIN_MAX)) _base.writeData(EE_ADDR_THIN_WINDOW, temp, INTERNAL);
+          }
+        }
+        else if (_base.checkText("radio budget ", buffer_int)) {
+          uint32_t budget = atol(buffer_int);
+          if (budget <= MAX_RADIO_BUDGET) {
+            _base.writeData(EE_ADDR_RADIO_BUDGET, budget, INTERNAL);
+            _server->link().setup(budget);
+          }
+        }
+#if !((decouplerComp)&&(F_CPU > 8000000 ))
+        else if (_base.checkText("thermal tau ", buffer_int)) {
+          uint32_t temp = atol(buffer_int);
+          if (temp <= MAX_THERMAL_TAU) {
+            _base.writeData(EE_ADDR_THERMAL_TAU, temp, INTERNAL);
+            thermal.setup(temp);
+          }
+        }
+#endif
+        else if (_base.checkText("adapt ", buffer_int)) {
+          if (_base.checkText("low ", buffer_int)) {
+            uint32_t temp = atol(buffer_int);
+            if (temp <= MAX_ADAPT) {
+              _base.writeData(EE_ADDR_ADAPT_LOW, temp, INTERNAL);
+              adaptLow = temp;
+            }
+          }
+          else if (_base.checkText("high ", buffer_int)) {
+            uint32_t temp = atol(buffer_int);
+            if (temp <= MAX_ADAPT) {
+              _base.writeData(EE_ADDR_ADAPT_HIGH, temp, INTERNAL);
+              adaptHigh = temp;
+            }
+          }
+        }
+        else if (_base.checkText("filter ", buffer_int)) {
+          for (byte i = 0; i < ADC_CHANNELS; i++) {
+            if (_base.checkText(FILTER_NAME[i], buffer_int)) {
+              _base.adcFilter(i, atol(buffer_int));
+              break;
+            }
+          }
+        }
+        else if (_base.checkText("period ", buffer_int)) {
+          for (byte i = 0; i < PERIODS; i++) {
+            if (_base.checkText(PERIOD_NAME[i], buffer_int)) {
+              uint32_t temp = atol(buffer_int);
+              if (temp <= MAX_PERIOD) _base.writeData(EE_ADDR_PERIOD + i * 4, temp, INTERNAL);
+              break;
+            }
+          }
+          loadPeriods();
+        }
+        else if (_base.checkText("event ", buffer_int)) {
+          if (_base.checkText("zscore ", buffer_int)) {
+            uint32_t zscore = atol(buffer_int);
+            if (zscore <= MAX_EVENT_ZSCORE) _base.writeData(EE_ADDR_EVENT_ZSCORE, zscore, INTERNAL);
+          }
+          else {
+            uint16_t eeaddress = 0;
+            if (_base.checkText("level ", buffer_int)) eeaddress = EE_ADDR_EVENT_LEVEL;
+            else if (_base.checkText("rate ", buffer_int)) eeaddress = EE_ADDR_EVENT_RATE;
+            for (byte i = 0; (i < EVENT_CHANNELS) && (eeaddress > 0); i++) {
+              if (_base.checkText(EVENT_NAME[i], buffer_int)) {
+                _base.writeData(eeaddress + i * 4, atol(buffer_int), INTERNAL);
+                break;
+              }
+            }
+          }
+          loadEvents();
+        }
       }
       else if (_base.checkText("clear memory\r", buffer_int)) _base.clearmemory();
       else if (_base.checkText("clear nets\r", buffer_int)) _base.writeData(EE_ADDR_NUMBER_NETS, NETWORKS, INTERNAL);
@@ -51,8 +51,14 @@ class SCKAmbient {
 #endif
 
     void readADXL(byte address, int num, byte buff[]);
-    uint16_t getLight();
-    unsigned int getNoise();
+    uint32_t getLight();
+    unsigned long getNoise();
+#if F_CPU == 8000000
+    void rangeNoise();
+#endif
+#if NOISE_OCTAVES
+    void getOctaves();
+#endif
 
     void txDebug();
     //boolean debug_state();
@@ -63,18 +69,57 @@ class SCKAmbient {
     void writeVH(byte device, long voltage );
     float readVH(byte device);
     void writeRL(byte device, long resistor);
+    void writeWiperRL(byte device, int data);
     float readRL(byte device);
     void writeRGAIN(byte device, long resistor);
     float readRGAIN(byte device);
-    void getVcc();
     void heat(byte device, int current);
+    void heaterTick();
+    boolean heaterSettled();
     float readRs(byte device);
-    float readMICS(byte device);
+    boolean rangeMICS(byte device, boolean first);
+    void runTasks(byte tasks);
+    long stepTask(byte task);
+    long stepClimate(byte &stage);
+    long stepLight(byte &stage);
+    long stepGas(byte &stage);
+    long stepAnalog(byte &);
     void writeADXL(byte address, byte val);
     void averageADXL();
+#if ((VIBRATION)&&(F_CPU == 8000000))
+    void vibration(byte entries, long *sum, uint32_t *square, int16_t *lo, int16_t *hi, byte *crossings);
+    void pollADXL();
+#endif
     void updateSensors(byte mode);
-    uint16_t readSHT21(uint8_t type);
-    boolean DhtRead(uint8_t pin);
+    void loadEvents();
+#if INTERVAL_STATS
+    void sampleStats();
+    void reportStats();
+#endif
+    void storeTasks(byte tasks);
+#if !((decouplerComp)&&(F_CPU > 8000000 ))
+    void updateThermal();
+    long thermalOffset();
+#endif
+    void sampleTasks();
+    void loadPeriods();
+    uint32_t updateInterval();
+    void adapt();
+    boolean gasWarmed();
+    void warmGas();
+    boolean checkEvents();
+    void startSHT21(uint8_t type);
+    byte collectSHT21(uint16_t *data);
+    byte crcSHT21(byte *data, byte len);
+    void setSHT21(byte resolution);
+    void startLight();
+    boolean lightValid();
+    uint32_t collectLight();
+#if F_CPU != 8000000
+    void DhtStart(uint8_t pin);
+    void DhtListen(uint8_t pin);
+    boolean DhtReady();
+#endif
     int addData(byte inByte);
     boolean printNetWorks(unsigned int address_eeprom, boolean endLine);
     void addNetWork(unsigned int address_eeprom, char* text);
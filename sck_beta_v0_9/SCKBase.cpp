@@ -13,6 +13,7 @@
 */
 
 #include "SCKBase.h"
+#include "NoiseMeter.h"
 #include <Wire.h>
 #include <EEPROM.h>
 
@@ -33,11 +34,13 @@ void SCKBase::begin()
   pinMode(CONTROL, INPUT);
   digitalWrite(AWAKE, LOW);
   digitalWrite(FACTORY, LOW);
+  adcBegin();
 }
 
 void SCKBase::config()
 {
   eepromCheck();
+  loadFilters();
   timer1Initialize();
 }
 
@@ -64,6 +67,48 @@ void SCKBase::eepromCheck()
   if (intTemp < DEFAULT_MIN_UPDATES || intTemp > POST_MAX) doClearMemory = true;
   if (doClearMemory) clearmemory();
 
+  //extended parameters are fixed one by one so a firmware update keeps the saved networks
+  intTemp = readData(EE_ADDR_EVENT_ZSCORE, INTERNAL);
+  if (intTemp > MAX_EVENT_ZSCORE) writeData(EE_ADDR_EVENT_ZSCORE, DEFAULT_EVENT_ZSCORE, INTERNAL);
+  intTemp = readData(EE_ADDR_RADIO_BUDGET, INTERNAL);
+  if (intTemp > MAX_RADIO_BUDGET) writeData(EE_ADDR_RADIO_BUDGET, DEFAULT_RADIO_BUDGET, INTERNAL);
+  intTemp = readData(EE_ADDR_UPLOAD_BUDGET, INTERNAL);
+  if (intTemp > MAX_TIME_UPDATE) writeData(EE_ADDR_UPLOAD_BUDGET, DEFAULT_UPLOAD_BUDGET, INTERNAL);
+  intTemp = readData(EE_ADDR_UPLOAD_BYTES, INTERNAL);
+  if (intTemp == 0xFFFFFFFF) writeData(EE_ADDR_UPLOAD_BYTES, DEFAULT_UPLOAD_BYTES, INTERNAL);
+  intTemp = readData(EE_ADDR_UPLOAD_ORDER, INTERNAL);
+  if (intTemp > UPLOAD_NEWEST) writeData(EE_ADDR_UPLOAD_ORDER, UPLOAD_OLDEST, INTERNAL);
+  intTemp = readData(EE_ADDR_THIN_START, INTERNAL);
+  if (intTemp > 100) writeData(EE_ADDR_THIN_START, DEFAULT_THIN_START, INTERNAL);
+  intTemp = readData(EE_ADDR_THIN_DEEP, INTERNAL);
+  if (intTemp > 100) writeData(EE_ADDR_THIN_DEEP, DEFAULT_THIN_DEEP, INTERNAL);
+  intTemp = readData(EE_ADDR_THIN_WINDOW, INTERNAL);
+  if ((intTemp < 4) || (intTemp > FIFO_THIN_MAX)) writeData(EE_ADDR_THIN_WINDOW, DEFAULT_THIN_WINDOW, INTERNAL);
+  intTemp = readData(EE_ADDR_SHT21_RESOLUTION, INTERNAL);
+  if (intTemp > SHT21_RES_MAX) writeData(EE_ADDR_SHT21_RESOLUTION, 0, INTERNAL);
+  intTemp = readData(EE_ADDR_GAS_PERIOD, INTERNAL);
+  if ((intTemp < GAS_PERIOD_MIN) || (intTemp > GAS_PERIOD_MAX)) writeData(EE_ADDR_GAS_PERIOD, DEFAULT_GAS_PERIOD, INTERNAL);
+  for (byte i = 0; i < PERIODS; i++) {
+    if (readData(EE_ADDR_PERIOD + i * 4, INTERNAL) > MAX_PERIOD) writeData(EE_ADDR_PERIOD + i * 4, 0, INTERNAL);
+  }
+  if (readData(EE_ADDR_ADAPT_LOW, INTERNAL) > MAX_ADAPT) writeData(EE_ADDR_ADAPT_LOW, 0, INTERNAL);
+  if (readData(EE_ADDR_ADAPT_HIGH, INTERNAL) > MAX_ADAPT) writeData(EE_ADDR_ADAPT_HIGH, 0, INTERNAL);
+  if (readData(EE_ADDR_THERMAL_TAU, INTERNAL) > MAX_THERMAL_TAU) writeData(EE_ADDR_THERMAL_TAU, DEFAULT_THERMAL_TAU, INTERNAL);
+  if ((readData(EE_ADDR_ADC_FILTER, INTERNAL) >> 16) != (ADC_FILTER_SAVED >> 16)) writeData(EE_ADDR_ADC_FILTER, DEFAULT_ADC_FILTER | ADC_FILTER_SAVED, INTERNAL);
+  intTemp = readData(EE_ADDR_STATS_RATE, INTERNAL);
+  if ((intTemp < STATS_RATE_MIN) || (intTemp > STATS_RATE_MAX)) writeData(EE_ADDR_STATS_RATE, DEFAULT_STATS_RATE, INTERNAL);
+  //readings stored with another layout can't be read back
+  if (readData(EE_ADDR_FIFO_LAYOUT, INTERNAL) != FIFO_LAYOUT) {
+#if USBEnabled
+    if (readData(EE_ADDR_NUMBER_READ_MEASURE, INTERNAL) != readData(EE_ADDR_NUMBER_WRITE_MEASURE, INTERNAL)) {
+      Serial.println(F("Stored readings have other channels, they are dropped!!"));
+    }
+#endif
+    writeData(EE_ADDR_NUMBER_READ_MEASURE, 0, INTERNAL);
+    writeData(EE_ADDR_NUMBER_WRITE_MEASURE, 0, INTERNAL);
+    writeData(EE_ADDR_FIFO_LAYOUT, FIFO_LAYOUT, INTERNAL);
+  }
+
   //if there are hardcoded networks write them without clearing memory
   //so the user can add more networks after hardcoded one's
 #if (NETWORKS > 0)
@@ -81,24 +126,244 @@ void SCKBase::eepromCheck()
 
 void SCKBase::clearmemory()
 {
-  for (uint16_t i = 0; i < (DEFAULT_ADDR_ANTENNA + 160); i++) EEPROM.write(i, 0x00); // Memory erasing
+  for (uint16_t i = 0; i < EE_ADDR_CONFIG_END; i++) EEPROM.write(i, 0x00); // Memory erasing
   writeData(EE_ADDR_SENSOR_MODE, DEFAULT_MODE_SENSOR, INTERNAL);
   writeData(EE_ADDR_TIME_UPDATE, DEFAULT_TIME_UPDATE, INTERNAL);
   writeData(EE_ADDR_NUMBER_UPDATES, DEFAULT_MIN_UPDATES, INTERNAL);
+  writeData(EE_ADDR_EVENT_ZSCORE, DEFAULT_EVENT_ZSCORE, INTERNAL);
+  writeData(EE_ADDR_RADIO_BUDGET, DEFAULT_RADIO_BUDGET, INTERNAL);
+  writeData(EE_ADDR_UPLOAD_BUDGET, DEFAULT_UPLOAD_BUDGET, INTERNAL);
+  writeData(EE_ADDR_UPLOAD_BYTES, DEFAULT_UPLOAD_BYTES, INTERNAL);
+  writeData(EE_ADDR_THIN_START, DEFAULT_THIN_START, INTERNAL);
+  writeData(EE_ADDR_THIN_DEEP, DEFAULT_THIN_DEEP, INTERNAL);
+  writeData(EE_ADDR_THIN_WINDOW, DEFAULT_THIN_WINDOW, INTERNAL);
+  writeData(EE_ADDR_GAS_PERIOD, DEFAULT_GAS_PERIOD, INTERNAL);
+  writeData(EE_ADDR_STATS_RATE, DEFAULT_STATS_RATE, INTERNAL);
+  writeData(EE_ADDR_THERMAL_TAU, DEFAULT_THERMAL_TAU, INTERNAL);
+  writeData(EE_ADDR_ADC_FILTER, DEFAULT_ADC_FILTER | ADC_FILTER_SAVED, INTERNAL);
+  writeData(EE_ADDR_FIFO_LAYOUT, FIFO_LAYOUT, INTERNAL);
   writeData(EE_ADDR_MAC, 0, MAC(), INTERNAL);
 }
 
+/*
+
+  ADC SAMPLER - Free running conversions spread over all the analog channels
+
+*/
+
+static const byte ADC_PINS[ADC_CHANNELS] = {S0, S1, S2, S3, S4, S5, BAT, PANEL};
+// The microphone takes every other conversion (about 4.8kS/s) for the noise meter
+static const byte ADC_SEQUENCE[ADC_SLOTS] = {ADC_NOISE, 0, ADC_NOISE, 1, ADC_NOISE, 2, ADC_NOISE, 3, ADC_NOISE, 5, ADC_NOISE, 6, ADC_NOISE, 7};
+NoiseMeter noiseMeter;
+byte adcFilterMode[ADC_CHANNELS];                   // Estimator of every channel, see average()
+byte adcMux[ADC_CHANNELS];                          // MUX5 in bit 5, MUX2:0 in bits 2:0
+byte adcRef = DEFAULT;
+volatile uint16_t adcSum[ADC_CHANNELS];             // 64 x 1023 still fits in 16 bits
+volatile byte adcCount[ADC_CHANNELS];
+volatile uint16_t adcWindow[ADC_CHANNELS];          // Last complete sum of ADC_WINDOW samples
+volatile byte adcFresh[ADC_CHANNELS];               // Windows published since the last reference change
+uint16_t adcPart[ADC_CHANNELS];                     // Sum of the block in progress
+volatile uint16_t adcBlock[ADC_CHANNELS][ADC_BLOCKS]; // Last ADC_BLOCKS sums of ADC_BLOCK samples
+volatile byte adcReading = 0;                       // Channel of the conversion just finished
+volatile byte adcConverting = 0;                    // Channel of the conversion in progress
+volatile byte adcSlot = 0;                          // Position of adcConverting in ADC_SEQUENCE
+boolean adcPaused = false;
+
+static inline void adcSelect(byte ch)
+{
+  ADCSRB = (ADCSRB & ~_BV(MUX5)) | (adcMux[ch] & _BV(MUX5));
+  ADMUX = (adcRef << 6) | (adcMux[ch] & 0x07);
+}
+
+ISR(ADC_vect)
+{
+  // In free running mode the next conversion has already started when this runs,
+  // so a new mux setting only applies to the one after it
+  uint16_t sample = ADC;
+  byte ch = adcReading;
+  adcSum[ch] += sample;
+  adcPart[ch] += sample;
+  if (!(++adcCount[ch] & (ADC_BLOCK - 1))) {
+    adcBlock[ch][(adcCount[ch] - 1) / ADC_BLOCK] = adcPart[ch];
+    adcPart[ch] = 0;
+  }
+  if (adcCount[ch] >= ADC_WINDOW) {
+    adcWindow[ch] = adcSum[ch];
+    adcSum[ch] = 0;
+    adcCount[ch] = 0;
+    if (adcFresh[ch] < 255) adcFresh[ch]++;
+  }
+  if ((ch == ADC_NOISE) && (adcRef == DEFAULT)) noiseMeter.sample(sample);
+  adcReading = adcConverting;
+  if (++adcSlot >= ADC_SLOTS) adcSlot = 0;
+  adcConverting = ADC_SEQUENCE[adcSlot];
+  adcSelect(adcConverting);
+}
+
+void SCKBase::adcBegin()
+{
+  for (byte i = 0; i < ADC_CHANNELS; i++) {
+    byte pin = ADC_PINS[i];
+    if (pin >= 18) pin -= 18;
+    adcMux[i] = analogPinToChannel(pin);
+    adcMux[i] = (adcMux[i] & 0x07) | ((adcMux[i] & 0x08) << 2);
+    adcFilterMode[i] = (DEFAULT_ADC_FILTER >> (2 * i)) & 0x03;
+  }
+  adcReference(DEFAULT);
+}
+
+void SCKBase::adcReference(uint8_t mode)
+{
+  // Restarts the sampler, the averages are not valid until every channel has a full window
+  ADCSRA = 0;
+  adcPaused = false;
+  adcRef = mode;
+  for (byte i = 0; i < ADC_CHANNELS; i++) {
+    adcSum[i] = 0;
+    adcPart[i] = 0;
+    adcCount[i] = 0;
+    adcFresh[i] = 0;
+  }
+  adcReading = ADC_SEQUENCE[0];
+  adcSlot = 1;
+  adcConverting = ADC_SEQUENCE[1];
+  adcSelect(adcReading);
+  ADCSRB &= ~(_BV(ADTS3) | _BV(ADTS2) | _BV(ADTS1) | _BV(ADTS0)); // free running
+#if F_CPU == 8000000
+  ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1);                // 125kHz
+#else
+  ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);    // 125kHz
+#endif
+  adcSelect(adcConverting);
+}
+
+// Stops the free running conversions for timing critical code (the DHT22 frame), the
+// windows in progress carry on after adcResume()
+void SCKBase::adcPause()
+{
+  if (adcPaused || !(ADCSRA & _BV(ADEN))) return;
+  adcPaused = true;
+  ADCSRA &= ~_BV(ADATE);
+  while (ADCSRA & _BV(ADSC));   // The last conversion ends and its interrupt stores it
+}
+
+void SCKBase::adcResume()
+{
+  if (!adcPaused) return;
+  adcPaused = false;
+  // Nothing converted adcReading since the pause, the sequence goes on from adcConverting
+  uint8_t oldSREG = SREG;
+  cli();
+  adcReading = adcConverting;
+  if (++adcSlot >= ADC_SLOTS) adcSlot = 0;
+  adcConverting = ADC_SEQUENCE[adcSlot];
+  adcSelect(adcReading);
+  ADCSRA |= _BV(ADATE) | _BV(ADSC);
+  adcSelect(adcConverting);
+  SREG = oldSREG;
+}
+
+NoiseMeter& SCKBase::noise()
+{
+  return noiseMeter;
+}
+
+// True once average() can answer without waiting
+boolean SCKBase::adcReady(int anaPin)
+{
+  byte ch = 0;
+  while ((ch < ADC_CHANNELS) && (ADC_PINS[ch] != anaPin)) ch++;
+  if (ch >= ADC_CHANNELS) return true;
+  return (adcFresh[ch] >= 2);
+}
+
 float SCKBase::average(int anaPin)
 {
-  int lecturas = 100;
-  long total = 0;
-  float average = 0;
-  for (int i = 0; i < lecturas; i++) {
-    //delay(1);
-    total = total + analogRead(anaPin);
+  byte ch = 0;
+  while ((ch < ADC_CHANNELS) && (ADC_PINS[ch] != anaPin)) ch++;
+  if (ch >= ADC_CHANNELS) return 0;
+  // The first window after a reference change is thrown away while the reference settles.
+  // Inside an interrupt nothing new can arrive, the last window is used as is.
+  unsigned long start = millis();
+  while ((adcFresh[ch] < 2) && (SREG & _BV(SREG_I)) && ((millis() - start) < ADC_TIMEOUT));
+  uint8_t oldSREG = SREG;
+  cli();
+  if (adcFilterMode[ch] == ADC_MEAN) {
+    uint16_t total = adcWindow[ch];
+    SREG = oldSREG;
+    return (float)total / ADC_WINDOW;
+  }
+  uint16_t block[ADC_BLOCKS];
+  for (byte i = 0; i < ADC_BLOCKS; i++) block[i] = adcBlock[ch][i];
+  SREG = oldSREG;
+  return (float)robust(block, adcFilterMode[ch]) / ADC_BLOCK;
+}
+
+// Estimators saved with 'set filter', channels in ADC_PINS order
+void SCKBase::loadFilters()
+{
+  uint32_t modes = readData(EE_ADDR_ADC_FILTER, INTERNAL);
+  for (byte i = 0; i < ADC_CHANNELS; i++) adcFilterMode[i] = (modes >> (2 * i)) & 0x03;
+}
+
+void SCKBase::adcFilter(byte ch, byte filter)
+{
+  if ((ch >= ADC_CHANNELS) || (filter > ADC_HAMPEL)) return;
+  uint32_t modes = readData(EE_ADDR_ADC_FILTER, INTERNAL);
+  modes = (modes & ~(0x03UL << (2 * ch))) | ((uint32_t)filter << (2 * ch));
+  writeData(EE_ADDR_ADC_FILTER, modes, INTERNAL);
+  adcFilterMode[ch] = filter;
+}
+
+byte SCKBase::adcFilter(byte ch)
+{
+  return adcFilterMode[ch];
+}
+
+// Insertion sort of the ADC_BLOCKS block sums, at most 28 moves
+static void adcSort(uint16_t *block)
+{
+  for (byte i = 1; i < ADC_BLOCKS; i++) {
+    uint16_t temp = block[i];
+    byte j = i;
+    for (; (j > 0) && (block[j - 1] > temp); j--) block[j] = block[j - 1];
+    block[j] = temp;
   }
-  average = (float)total / lecturas;
-  return (average);
+}
+
+// Robust block sum of a window: a glitch only spoils the few blocks it falls in
+uint16_t SCKBase::robust(uint16_t *block, byte filter)
+{
+  uint16_t sorted[ADC_BLOCKS];
+  for (byte i = 0; i < ADC_BLOCKS; i++) sorted[i] = block[i];
+  adcSort(sorted);
+  uint16_t median = (sorted[ADC_BLOCKS / 2 - 1] + sorted[ADC_BLOCKS / 2]) / 2;
+  if (filter == ADC_MEDIAN) return median;
+  if (filter == ADC_TRIMMED) {
+    uint16_t total = 0;
+    for (byte i = ADC_TRIM; i < ADC_BLOCKS - ADC_TRIM; i++) total += sorted[i];
+    return total / (ADC_BLOCKS - 2 * ADC_TRIM);
+  }
+  // Hampel: blocks more than ADC_HAMPEL_K x 1.4826 MAD away from the median are replaced by it
+  for (byte i = 0; i < ADC_BLOCKS; i++) sorted[i] = abs((int16_t)(block[i] - median));
+  adcSort(sorted);
+  uint32_t limit = ((uint32_t)(sorted[ADC_BLOCKS / 2 - 1] + sorted[ADC_BLOCKS / 2]) * ADC_HAMPEL_K * 1483) / 2000;
+  if (limit < ADC_BLOCK) limit = ADC_BLOCK;   // A flat window (MAD 0) keeps the blocks within a count per sample
+  uint32_t total = 0;
+  for (byte i = 0; i < ADC_BLOCKS; i++) {
+    if ((uint16_t)abs((int16_t)(block[i] - median)) > limit) total += median;
+    else total += block[i];
+  }
+  return total / ADC_BLOCKS;
+}
+
+// Prints entry i of a PROGMEM table of NUL terminated labels (SERVER, SENSOR or UNITS)
+size_t SCKBase::printLabel(Print& port, const char* table, byte i)
+{
+  while (i > 0) {
+    if (pgm_read_byte(table++) == 0x00) i--;
+  }
+  return port.print((const __FlashStringHelper*)table);
 }
 
 boolean SCKBase::checkText(char* text, char *text1)
@@ -139,24 +404,57 @@ boolean SCKBase::compareData(char* text, char* text1)
 
 float kr = ((float)P1 * 1000) / RES; //  Resistance conversion Constant for the digital pot.
 
+/*
+
+  MCP - Digital potentiometers, the wipers are mirrored in RAM (write-through)
+
+*/
+
+uint16_t mcpShadow[MCP_SLOTS];              // MCP_UNKNOWN until read or written
+boolean mcpShadowInit = false;
+
+static int mcpSlot(byte deviceaddress, byte address)
+{
+  if (!mcpShadowInit) {
+    for (byte i = 0; i < MCP_SLOTS; i++) mcpShadow[i] = MCP_UNKNOWN;
+    mcpShadowInit = true;
+  }
+  // 0x2D-0x2F, volatile wipers 0, 1, 2 (0x06) and 3 (0x07)
+  if ((deviceaddress < MCP_FIRST) || (deviceaddress >= MCP_FIRST + MCP_DEVICES)) return -1;
+  if (address > 0x07) return -1;
+  if (address >= 0x06) address -= 4;
+  else if (address > 0x01) return -1;
+  return (deviceaddress - MCP_FIRST) * 4 + address;
+}
+
 void SCKBase::writeMCP(byte deviceaddress, byte address, int data )
 {
   if (data > RES) data = RES;
+  int slot = mcpSlot(deviceaddress, address);
+  if ((slot >= 0) && (mcpShadow[slot] == data)) return; // Already there, no write delay
   Wire.beginTransmission(deviceaddress);
-  address = (address << 4) | bitRead(data, 8) ;
-  Wire.write(address);
+  Wire.write((address << 4) | bitRead(data, 8));
   Wire.write(lowByte(data));
-  Wire.endTransmission();
+  if ((Wire.endTransmission() == 0) && (slot >= 0)) mcpShadow[slot] = data;
+  else if (slot >= 0) mcpShadow[slot] = MCP_UNKNOWN;
   delay(4);
 }
 
 int SCKBase::readMCP(int deviceaddress, uint16_t address )
+{
+  int slot = mcpSlot(deviceaddress, address);
+  if ((slot >= 0) && (mcpShadow[slot] != MCP_UNKNOWN)) return mcpShadow[slot];
+  return rereadMCP(deviceaddress, address);
+}
+
+// Reads the wiper from the device whatever the shadow says
+int SCKBase::rereadMCP(int deviceaddress, uint16_t address )
 {
   byte rdata = 0xFF;
   int  data = 0x0000;
+  int slot = mcpSlot(deviceaddress, address);
   Wire.beginTransmission(deviceaddress);
-  address = (address << 4) | B00001100;
-  Wire.write(address);
+  Wire.write((address << 4) | B00001100);
   Wire.endTransmission();
   Wire.requestFrom(deviceaddress, 2);
   unsigned long time = millis();
@@ -165,10 +463,36 @@ int SCKBase::readMCP(int deviceaddress, uint16_t address )
   data = rdata << 8;
   while (!Wire.available());
   rdata = Wire.read();
-  data = data | rdata;
+  data = (data | rdata) & MCP_MASK;
+  if (slot >= 0) mcpShadow[slot] = data;
   return data;
 }
 
+// Compares every known wiper with the device and writes back the ones that drifted
+byte SCKBase::verifyMCP()
+{
+  byte errors = 0;
+  mcpSlot(0, 0); // Makes sure the shadow is initialised
+  for (byte i = 0; i < MCP_SLOTS; i++) {
+    uint16_t expected = mcpShadow[i];
+    if (expected == MCP_UNKNOWN) continue;
+    byte deviceaddress = MCP_FIRST + (i >> 2);
+    byte address = i & 0x03;
+    if (address > 0x01) address += 4;
+    if (rereadMCP(deviceaddress, address) != expected) {
+      errors++;
+      writeMCP(deviceaddress, address, expected);
+    }
+  }
+#if debugBASE
+  if (errors > 0) {
+    Serial.print("MCP wipers restored: ");
+    Serial.println(errors);
+  }
+#endif
+  return errors;
+}
+
 #if F_CPU == 8000000
 #define MCP3               0x2D    // Direction of the mcp3 Ajust the battary charge
 float SCKBase::readCharge()
@@ -419,30 +743,67 @@ uint16_t SCKBase::getPanel(float Vref)
 #endif
   return value;
 }
-/*
-  const uint16_t batTable[] = {
-  3078, 3364, 3468, 3540, 3600,
-  3641, 3682, 3701, 3710, 3716,
-  3716, 3716, 3720, 3714, 3720,
-  3725, 3732, 3742, 3739, 3744,
-  3744, 3754, 3760, 3762, 3770,
-  3768, 3774, 3774, 3774, 3779,
-  3784, 3790, 3788, 3794, 3798,
-  3798, 3804, 3809, 3809, 3812,
-  3817, 3817, 3822, 3823, 3828,
-  3828, 3828, 3833, 3838, 3838,
-  3842, 3847, 3852, 3859, 3858,
-  3864, 3862, 3869, 3877, 3877,
-  3883, 3888, 3894, 3898, 3902,
-  3906, 3912, 3923, 3926, 3936,
-  3942, 3946, 3960, 3972, 3979,
-  3982, 3991, 3997, 4002, 4002,
-  4012, 4018, 4028, 4043, 4057,
-  4074, 4084, 4094, 4098, 4098,
-  4109, 4115, 4123, 4134, 4142,
-  4153, 4158, 4170, 4180, 4188
-  };
-*/
+// Battery voltage (mV) at BAT_POINTS evenly spread charges from empty to full, from the
+// measured discharge curve (batCurve() gives the charge in tenths of %, 0 to 1000). The few dips of the measurement are flattened so the table can be searched.
+static const uint16_t BAT_TABLE[BAT_POINTS] PROGMEM = {
+  3078, 3364, 3468, 3540, 3600, 3641, 3682, 3701, 3710, 3716,
+  3716, 3716, 3720, 3720, 3720, 3725, 3732, 3742, 3742, 3744,
+  3744, 3754, 3760, 3762, 3770, 3770, 3774, 3774, 3774, 3779,
+  3784, 3790, 3790, 3794, 3798, 3798, 3804, 3809, 3809, 3812,
+  3817, 3817, 3822, 3823, 3828, 3828, 3828, 3833, 3838, 3838,
+  3842, 3847, 3852, 3859, 3859, 3864, 3864, 3869, 3877, 3877,
+  3883, 3888, 3894, 3898, 3902, 3906, 3912, 3923, 3926, 3936,
+  3942, 3946, 3960, 3972, 3979, 3982, 3991, 3997, 4002, 4002,
+  4012, 4018, 4028, 4043, 4057, 4074, 4084, 4094, 4098, 4098,
+  4109, 4115, 4123, 4134, 4142, 4153, 4158, 4170, 4180, 4188
+};
+
+float batSoc = -1;           // State of charge (tenths of %), -1 until the first reading
+unsigned long batAt = 0;
+float batVoltage = 0;        // mV of the last reading
+
+// State of charge (tenths of %) of a battery voltage, binary search and linear interpolation
+static uint16_t batCurve(float mV)
+{
+  if (mV <= pgm_read_word(BAT_TABLE)) return 0;
+  if (mV >= pgm_read_word(BAT_TABLE + BAT_POINTS - 1)) return 1000;
+  byte lo = 0;                // BAT_TABLE[lo] <= mV < BAT_TABLE[hi]
+  byte hi = BAT_POINTS - 1;
+  while ((hi - lo) > 1) {
+    byte mid = (lo + hi) / 2;
+    if (pgm_read_word(BAT_TABLE + mid) <= mV) lo = mid;
+    else hi = mid;
+  }
+  uint16_t v0 = pgm_read_word(BAT_TABLE + lo);
+  uint16_t v1 = pgm_read_word(BAT_TABLE + hi);
+  return ((lo + (mV - v0) / (v1 - v0)) * 1000) / (BAT_POINTS - 1);
+}
+
+// mV feeding the charger, 0 when the kit runs from the battery
+uint16_t SCKBase::chargeInput(float Vref)
+{
+  if (USBSTA & _BV(VBUS)) return 5000;
+  return getPanel(Vref);
+}
+
+// mA into the battery, 0 when there is no input or the battery is full. Nothing measures
+// the current: it is the charger setting (the MCP3 setpoint on the 1.1), scaled down when
+// the input is too close to the battery to give it, as a weak panel is. Still an upper bound,
+// far off once the current tapers from BAT_CV_VOLTAGE.
+float SCKBase::chargeCurrent(float Vref)
+{
+  uint16_t input = chargeInput(Vref);
+  if ((input == 0) || (batVoltage >= VAL_MAX_BATTERY)) return 0;
+  float headroom = (input - batVoltage) / BAT_CHARGE_HEADROOM;
+  if (headroom <= 0) return 0;
+  if (headroom > 1) headroom = 1;
+#if F_CPU == 8000000
+  return readCharge() * headroom;
+#else
+  return BAT_CHARGE_CURRENT * headroom;
+#endif
+}
+
 uint16_t SCKBase::getBattery(float Vref)
 {
   uint16_t temp = average(BAT);
@@ -452,9 +813,30 @@ uint16_t SCKBase::getBattery(float Vref)
 #else
   float voltage = Vref * temp / 1023.;
 #endif
-  uint16_t percent = map(voltage, VAL_MIN_BATTERY, VAL_MAX_BATTERY, 0, 100) * 10;
-  if (percent > 1000) percent = 1000;
-  else if (percent < 10) percent = 10;
+  // The curve is trusted at rest, the coulomb count while the charger raises the voltage at
+  // constant current. The current tapers off from BAT_CV_VOLTAGE and is not measured, so
+  // there only the curve moves the estimate, slowly. The blend depends on the time since
+  // the last call, not on how often it is called.
+  batVoltage = voltage;
+  float curve = batCurve(voltage);
+  unsigned long now = millis();
+  if (batSoc < 0) batSoc = curve;
+  else {
+    float dt = now - batAt;
+    float tau = BAT_REST_TAU;
+#if F_CPU == 8000000
+    float current = chargeCurrent(Vref);
+    if (current > 0) {
+      if (voltage < BAT_CV_VOLTAGE) batSoc += current * dt * 1000 / ((float)hour * BAT_CAPACITY); // mA x ms -> tenths of %
+      tau = BAT_CHARGE_TAU;
+    }
+#endif
+    batSoc += (curve - batSoc) * dt / (dt + tau * second);
+  }
+  batAt = now;
+  if (batSoc > 1000) batSoc = 1000;
+  uint16_t percent = batSoc;
+  if (percent < 10) percent = 10;
 #if debugBASE
   Serial.print("Vbat: ");
   Serial.print(voltage);
@@ -755,6 +1137,18 @@ char* SCKBase::id()
   return buffer;
 }
 
+uint32_t SCKBase::hashMAC()
+{
+  // FNV-1a of the stored MAC, a stable per device number to spread the kits over time
+  char* mac = readData(EE_ADDR_MAC, 0, INTERNAL);
+  uint32_t hash = 2166136261UL;
+  for (byte i = 0; mac[i] != 0x00; i++) {
+    hash ^= (byte)mac[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
 uint32_t SCKBase::scan()
 {
   if (enterCommandMode()){
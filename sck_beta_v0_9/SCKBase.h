@@ -20,6 +20,7 @@
 
 #include <Arduino.h>
 #include "Constants.h"
+#include "NoiseMeter.h"
 
 class SCKBase {
   public:
@@ -28,10 +29,23 @@ class SCKBase {
     void eepromCheck();
     void clearmemory();
     float average(int anaPin);
+    void adcBegin();
+    void adcReference(uint8_t mode);
+    void adcPause();
+    void adcResume();
+    boolean adcReady(int anaPin);
+    void loadFilters();
+    void adcFilter(byte ch, byte filter);
+    byte adcFilter(byte ch);
+    uint16_t robust(uint16_t *block, byte filter);
+    NoiseMeter& noise();
     boolean checkText(char* text, char* text1);
+    size_t printLabel(Print& port, const char* table, byte i);
     boolean compareData(char* text, char* text1);
     void writeMCP(byte deviceaddress, byte address, int data );
     int readMCP(int deviceaddress, uint16_t address );
+    int rereadMCP(int deviceaddress, uint16_t address );
+    byte verifyMCP();
     float readCharge();
     void writeCharge(int current);
     void writeEEPROM(uint16_t eeaddress, uint8_t data);
@@ -43,6 +57,8 @@ class SCKBase {
 
     uint16_t getPanel(float Vref);
     uint16_t getBattery(float Vref);
+    uint16_t chargeInput(float Vref);
+    float chargeCurrent(float Vref);
 
     /*RTC commands*/
     boolean checkRTC();
@@ -71,6 +87,7 @@ class SCKBase {
     boolean close();
     char* MAC();
     char* id();
+    uint32_t hashMAC();
     uint32_t scan();
     int checkWiFly();
     int getWiFlyVersion();
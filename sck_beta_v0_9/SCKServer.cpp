@@ -8,9 +8,30 @@
 #include <EEPROM.h>
 #include "SCKServer.h"
 
-SCKServer::SCKServer(SCKBase& base)
+SCKServer::SCKServer(SCKBase& base) : _base(base)
 {
-  _base = base;
+  _scanAt = 0;
+}
+
+boolean SCKServer::join()
+{
+  // Joining is the expensive part (rejoin, save and reboot of the WiFly), only try when the manager allows it
+  if (!_link.allow()) return false;
+  _link.start();
+  if (_base.connect()) return true;
+  _link.stop(false);
+  return false;
+}
+
+// A failed session counts as a failed connection, the manager schedules the next try
+void SCKServer::leave(boolean ok)
+{
+  _link.stop(ok);
+}
+
+ConnectionManager& SCKServer::link()
+{
+  return _link;
 }
 
 boolean SCKServer::time(char *time_)
@@ -94,106 +115,289 @@ boolean SCKServer::RTCupdate(char *time_)
   return false;
 }
 
-void SCKServer::json_update(uint16_t updates, long *value, char *time, boolean isMultipart)
+uint16_t SCKServer::json_update(uint16_t updates, long *value, char *time, boolean isMultipart)
 {
+  // The live reading goes first, stored ones follow until the upload budget (if limited) runs out
+  uint16_t posted = 0;
 #if debugServer
   Serial.print(F("["));
 #endif
   Serial1.print(F("["));
-  for (int i = 0; i < updates; i++) {
-    readFIFO();
-    if ((i < (updates - 1)) || (isMultipart)) {
-      Serial1.print(F(","));
-#if debugServer
-      Serial.print(F(","));
-#endif
-    }
-  }
-
   if (isMultipart) {
     byte i;
-    for (i = 0; i < 9; i++) {
-      Serial1.print(SERVER[i]);
-      Serial1.print(value[i]);
+    for (i = 0; i < SENSORS; i++) {
+      _sent += _base.printLabel(Serial1, SERVER, i);
+      _sent += Serial1.print(value[i]);
     }
-    Serial1.print(SERVER[i]);
-    Serial1.print(time);
-    Serial1.print(SERVER[i + 1]);
-    Serial1.println(F("]"));
-    Serial1.println();
+    _sent += _base.printLabel(Serial1, SERVER, i);
+    _sent += Serial1.print(time);
+    _sent += _base.printLabel(Serial1, SERVER, i + 1);
 
 #if debugServer
-    for (i = 0; i < 9; i++) {
-      Serial.print(SERVER[i]);
+    for (i = 0; i < SENSORS; i++) {
+      _base.printLabel(Serial, SERVER, i);
       Serial.print(value[i]);
     }
-    Serial.print(SERVER[i]);
+    _base.printLabel(Serial, SERVER, i);
     Serial.print(time);
-    Serial.print(SERVER[i + 1]);
+    _base.printLabel(Serial, SERVER, i + 1);
+#endif
+  }
+  for (posted = 0; posted < updates; posted++) {
+    if ((posted > 0) && _limited && budgetExceeded()) break;
+    if ((posted > 0) || (isMultipart)) {
+      Serial1.print(F(","));
+#if debugServer
+      Serial.print(F(","));
 #endif
+    }
+    _sent += readFIFO();
   }
   Serial1.println(F("]"));
   Serial1.println();
 #if debugServer
   Serial.println(F("]"));
 #endif
+  return posted;
+}
+
+/*
+
+  FIFO - Readings waiting to be posted, kept as a ring in the external EEPROM
+
+*/
+
+uint32_t SCKServer::stepFIFO(uint32_t eeaddress, int records)
+{
+  long temp = (long)eeaddress + (long)records * FIFO_RECORD;
+  if (temp < 0) temp += FIFO_END;
+  else if (temp >= FIFO_END) temp -= FIFO_END;
+  return temp;
+}
+
+uint16_t SCKServer::pendingFIFO()
+{
+  uint32_t readAddress = _base.readData(EE_ADDR_NUMBER_READ_MEASURE, INTERNAL);
+  uint32_t writeAddress = _base.readData(EE_ADDR_NUMBER_WRITE_MEASURE, INTERNAL);
+  if (writeAddress < readAddress) writeAddress += FIFO_END;
+  return (writeAddress - readAddress) / FIFO_RECORD;
 }
 
 void SCKServer::addFIFO(long *value, char *time)
 {
-  uint16_t updates = (_base.readData(EE_ADDR_NUMBER_WRITE_MEASURE, INTERNAL) - _base.readData(EE_ADDR_NUMBER_READ_MEASURE, INTERNAL)) / ((SENSORS) * 4 + TIME_BUFFER_SIZE);
-  if (updates < MAX_MEMORY) {
-    int eeaddress = _base.readData(EE_ADDR_NUMBER_WRITE_MEASURE, INTERNAL);
-    int i = 0;
-    for (i = 0; i < 9; i++) {
-      _base.writeData(eeaddress + i * 4, value[i], EXTERNAL);
-    }
-    _base.writeData(eeaddress + i * 4, 0, time, EXTERNAL);
-    eeaddress = eeaddress + (SENSORS) * 4 + TIME_BUFFER_SIZE;
-    _base.writeData(EE_ADDR_NUMBER_WRITE_MEASURE, eeaddress, INTERNAL);
+  uint16_t updates = pendingFIFO();
+  // Past the start mark the oldest readings are merged in one batch down to FIFO_THIN_BATCH %
+  // below it, so the EEPROM is only rewritten now and then instead of on every reading
+  uint32_t high = _base.readData(EE_ADDR_THIN_START, INTERNAL) * (FIFO_SIZE - 1) / 100;
+  if (high > FIFO_SIZE - 4) high = FIFO_SIZE - 4;
+  if (updates >= high) {
+    uint32_t low = (high > (uint32_t)FIFO_THIN_BATCH * FIFO_SIZE / 100) ? high - (uint32_t)FIFO_THIN_BATCH * FIFO_SIZE / 100 : 0;
+    while ((updates > low) && thinFIFO(updates)) updates = pendingFIFO();
   }
-  else {
+  if (updates >= (FIFO_SIZE - 1)) {
+    // Nothing could be merged, the oldest reading goes so the newest one is kept
+    _base.writeData(EE_ADDR_NUMBER_READ_MEASURE, stepFIFO(_base.readData(EE_ADDR_NUMBER_READ_MEASURE, INTERNAL), 1), INTERNAL);
 #if debugEnabled
     if (!_base.getDebugState()) Serial.println(F("Memory limit exceeded!!"));
 #endif
   }
+  uint32_t eeaddress = _base.readData(EE_ADDR_NUMBER_WRITE_MEASURE, INTERNAL);
+  for (byte i = 0; i < SENSORS; i++) {
+    _base.writeData(eeaddress + i * 4, value[i], EXTERNAL);
+  }
+  _base.writeData(eeaddress + FIFO_HEADER, ((uint32_t)FIFO_GROUPS << 24) | ((uint32_t)FIFO_RAW << 16), EXTERNAL);
+  writeTime(eeaddress + FIFO_TIME, time);
+  _base.writeData(EE_ADDR_NUMBER_WRITE_MEASURE, stepFIFO(eeaddress, 1), INTERNAL);
+}
+
+// The time takes TIME_BUFFER_SIZE bytes of the record, SCKBase::writeData() would clear buffer_length
+void SCKServer::writeTime(uint32_t eeaddress, char *time)
+{
+  byte i = 0;
+  for (; (i < TIME_BUFFER_SIZE - 1) && (time[i] != 0x00); i++) _base.writeEEPROM(eeaddress + i, time[i]);
+  for (; i < TIME_BUFFER_SIZE; i++) _base.writeEEPROM(eeaddress + i, 0x00);
+}
+
+boolean SCKServer::thinFIFO(uint16_t updates)
+{
+  // Merges the oldest readings into a min/mean/max triple appended at the write end.
+  // Every record keeps its own timestamp, so the merged ones don't need to stay in place,
+  // but the triples are posted among the newest readings when they go newest first.
+  if ((FIFO_SIZE - 1 - updates) < 3) return false;
+  uint32_t window = _base.readData(EE_ADDR_THIN_WINDOW, INTERNAL);
+  if ((uint32_t)updates * 100 >= _base.readData(EE_ADDR_THIN_DEEP, INTERNAL) * (FIFO_SIZE - 1)) window = window * 2;
+  if (window > FIFO_THIN_MAX) window = FIFO_THIN_MAX;
+
+  // Two more records than the window, so a triple starting at its end is taken whole
+  byte kind[FIFO_THIN_MAX + 2];
+  uint16_t span[FIFO_THIN_MAX + 2];
+  byte records = 0;
+  uint32_t readAddress = _base.readData(EE_ADDR_NUMBER_READ_MEASURE, INTERNAL);
+  uint32_t eeaddress = readAddress;
+  while ((records < updates) && (records < FIFO_THIN_MAX + 2)) {
+    uint32_t header = _base.readData(eeaddress + FIFO_HEADER, EXTERNAL);
+    byte temp = header >> 16;
+    if ((records >= window) && (temp != FIFO_MEAN) && (temp != FIFO_MAX)) break; // Don't split a triple
+    kind[records] = temp;
+    span[records] = header & 0xFFFF;
+    if (span[records] == 0) span[records] = 1;
+    records++;
+    eeaddress = stepFIFO(eeaddress, 1);
+  }
+  if (records < 4) return false; // Merging would not free anything
+
+  uint32_t writeAddress = _base.readData(EE_ADDR_NUMBER_WRITE_MEASURE, INTERNAL);
+  uint32_t total = 0;
+  for (byte c = 0; c < SENSORS; c++) {
+    long lo = 0;
+    long hi = 0;
+    boolean loSet = false;
+    boolean hiSet = false;
+    float sum = 0;
+    uint32_t weight = 0;
+    eeaddress = readAddress;
+    for (byte j = 0; j < records; j++) {
+      long temp = (long)_base.readData(eeaddress + c * 4, EXTERNAL);
+      if ((kind[j] == FIFO_RAW) || (kind[j] == FIFO_MIN)) {
+        if (!loSet || (temp < lo)) lo = temp;
+        loSet = true;
+      }
+      if ((kind[j] == FIFO_RAW) || (kind[j] == FIFO_MAX)) {
+        if (!hiSet || (temp > hi)) hi = temp;
+        hiSet = true;
+      }
+      if ((kind[j] == FIFO_RAW) || (kind[j] == FIFO_MEAN)) {
+        sum += (float)temp * span[j];
+        weight += span[j];
+      }
+      eeaddress = stepFIFO(eeaddress, 1);
+    }
+    long mean = (weight > 0) ? (long)(sum / weight) : (lo + hi) / 2;
+    if (!loSet) lo = mean;
+    if (!hiSet) hi = mean;
+    _base.writeData(writeAddress + c * 4, lo, EXTERNAL);
+    _base.writeData(stepFIFO(writeAddress, 1) + c * 4, mean, EXTERNAL);
+    _base.writeData(stepFIFO(writeAddress, 2) + c * 4, hi, EXTERNAL);
+    total = weight;
+  }
+  if (total == 0) total = 1;
+  if (total > 0xFFFF) total = 0xFFFF;
+
+  // The triple is stamped with the earliest valid time of the merged readings
+  char first[TIME_BUFFER_SIZE];
+  first[0] = '#';
+  first[1] = 0x00;
+  eeaddress = readAddress;
+  for (byte j = 0; j < records; j++) {
+    char* temp = _base.readData(eeaddress + FIFO_TIME, 0, EXTERNAL);
+    if ((temp[0] != '#') && (temp[0] != 0x00) && ((first[0] == '#') || (strcmp(temp, first) < 0))) {
+      strncpy(first, temp, TIME_BUFFER_SIZE - 1);
+      first[TIME_BUFFER_SIZE - 1] = 0x00;
+    }
+    eeaddress = stepFIFO(eeaddress, 1);
+  }
+  for (byte j = 0; j < 3; j++) {
+    eeaddress = stepFIFO(writeAddress, j);
+    _base.writeData(eeaddress + FIFO_HEADER, ((uint32_t)FIFO_GROUPS << 24) | ((uint32_t)(FIFO_MIN + j) << 16) | total, EXTERNAL);
+    writeTime(eeaddress + FIFO_TIME, first);
+  }
+  _base.writeData(EE_ADDR_NUMBER_WRITE_MEASURE, stepFIFO(writeAddress, 3), INTERNAL);
+  _base.writeData(EE_ADDR_NUMBER_READ_MEASURE, stepFIFO(readAddress, records), INTERNAL);
+#if debugEnabled
+  if (!_base.getDebugState()) {
+    Serial.print(F("Memory thinned, readings merged: "));
+    Serial.println(records);
+  }
+#endif
+  return true;
+}
+
+void SCKServer::seekFIFO()
+{
+  // Oldest first walks forward from the read pointer, newest first walks back from the write pointer
+  if (_newestFirst) _cursor = stepFIFO(_base.readData(EE_ADDR_NUMBER_WRITE_MEASURE, INTERNAL), -1);
+  else _cursor = _base.readData(EE_ADDR_NUMBER_READ_MEASURE, INTERNAL);
+}
+
+size_t SCKServer::printAggregate(Print& port, uint32_t header)
+{
+  // Merged readings tell which statistic they carry and how many readings they cover
+  size_t sent = 0;
+  byte kind = header >> 16;
+  if (kind == FIFO_RAW) return 0;
+  if (kind == FIFO_MIN) sent += port.print(F("\",\"agg\":\"min"));
+  else if (kind == FIFO_MEAN) sent += port.print(F("\",\"agg\":\"mean"));
+  else sent += port.print(F("\",\"agg\":\"max"));
+  sent += port.print(F("\",\"n\":\""));
+  sent += port.print(header & 0xFFFF);
+  return sent;
 }
 
-void SCKServer::readFIFO()
+size_t SCKServer::readFIFO()
 {
+  // Prints the record under the cursor, the FIFO itself only moves in commitFIFO()
+  size_t sent = 0;
   int i = 0;
-  int eeaddress = _base.readData(EE_ADDR_NUMBER_READ_MEASURE, INTERNAL);
-  for (i = 0; i < 9; i++) {
-    Serial1.print(SERVER[i]);
-    Serial1.print(_base.readData(eeaddress + i * 4, EXTERNAL)); //SENSORS
+  uint32_t eeaddress = _cursor;
+  uint32_t header = _base.readData(eeaddress + FIFO_HEADER, EXTERNAL);
+  for (i = 0; i < SENSORS; i++) {
+    sent += _base.printLabel(Serial1, SERVER, i);
+    sent += Serial1.print((long)_base.readData(eeaddress + i * 4, EXTERNAL)); //SENSORS
   }
-  Serial1.print(SERVER[i]);
-  Serial1.print(_base.readData(eeaddress + i * 4, 0, EXTERNAL)); //TIME
-  Serial1.print(SERVER[i + 1]);
+  sent += printAggregate(Serial1, header);
+  sent += _base.printLabel(Serial1, SERVER, i);
+  sent += Serial1.print(_base.readData(eeaddress + FIFO_TIME, 0, EXTERNAL)); //TIME
+  sent += _base.printLabel(Serial1, SERVER, i + 1);
 
 #if debugServer
-  for (i = 0; i < 9; i++) {
-    Serial.print(SERVER[i]);
-    Serial.print(_base.readData(eeaddress + i * 4, EXTERNAL)); //SENSORS
+  for (i = 0; i < SENSORS; i++) {
+    _base.printLabel(Serial, SERVER, i);
+    Serial.print((long)_base.readData(eeaddress + i * 4, EXTERNAL)); //SENSORS
   }
-  Serial.print(SERVER[i]);
-  Serial.print(_base.readData(eeaddress + i * 4, 0, EXTERNAL)); //TIME
-  Serial.print(SERVER[i + 1]);
+  printAggregate(Serial, header);
+  _base.printLabel(Serial, SERVER, i);
+  Serial.print(_base.readData(eeaddress + FIFO_TIME, 0, EXTERNAL)); //TIME
+  _base.printLabel(Serial, SERVER, i + 1);
 #endif
 
-  eeaddress = eeaddress + (SENSORS) * 4 + TIME_BUFFER_SIZE;
-  if (eeaddress == _base.readData(EE_ADDR_NUMBER_WRITE_MEASURE, INTERNAL)) {
+  _cursor = stepFIFO(_cursor, _newestFirst ? -1 : 1);
+  return sent;
+}
+
+void SCKServer::commitFIFO(uint16_t posted)
+{
+  uint32_t readAddress = _base.readData(EE_ADDR_NUMBER_READ_MEASURE, INTERNAL);
+  uint32_t writeAddress = _base.readData(EE_ADDR_NUMBER_WRITE_MEASURE, INTERNAL);
+  if (posted >= pendingFIFO()) {
     _base.writeData(EE_ADDR_NUMBER_WRITE_MEASURE, 0, INTERNAL);
     _base.writeData(EE_ADDR_NUMBER_READ_MEASURE, 0, INTERNAL);
   }
-  else _base.writeData(EE_ADDR_NUMBER_READ_MEASURE, eeaddress, INTERNAL);
+  else if (_newestFirst) _base.writeData(EE_ADDR_NUMBER_WRITE_MEASURE, stepFIFO(writeAddress, -(int)posted), INTERNAL);
+  else _base.writeData(EE_ADDR_NUMBER_READ_MEASURE, stepFIFO(readAddress, posted), INTERNAL);
+}
+
+boolean SCKServer::budgetExceeded()
+{
+  if ((_deadline > 0) && ((long)(millis() - _deadline) >= 0)) return true;
+  if ((_byteBudget > 0) && (_sent >= _byteBudget)) return true;
+  return false;
 }
 
 #define numbers_retry 5
 
-boolean SCKServer::update(long *value, char *time_)
+// Wi-Fi nets in value[8], scanned again only once the scan period is over (0 = every call)
+void SCKServer::scan(long *value)
 {
+  uint32_t scanPeriod = _base.readData(EE_ADDR_PERIOD + PERIOD_SCAN * 4, INTERNAL);
+  if ((scanPeriod > 0) && (_scanAt > 0) && ((millis() - _scanAt) < scanPeriod * second)) return;
   value[8] = _base.scan();  //Wifi Nets
+  _scanAt = millis();
+  if (_scanAt == 0) _scanAt = 1;
+}
+
+boolean SCKServer::update(long *value, char *time_)
+{
+  scan(value);
   byte retry = 0;
   if (time(time_)) {
     //Update server time
@@ -264,22 +468,23 @@ void SCKServer::send(boolean sleep, boolean *wait_moment, long *value, char *tim
 {
   *wait_moment = true;
   if (_base.checkRTC()) _base.RTCtime(time);
-  char tmpTime[19];
-  strncpy(tmpTime, time, 20);
-  uint16_t updates = (_base.readData(EE_ADDR_NUMBER_WRITE_MEASURE, INTERNAL) - _base.readData(EE_ADDR_NUMBER_READ_MEASURE, INTERNAL)) / ((SENSORS) * 4 + TIME_BUFFER_SIZE);
+  char tmpTime[TIME_BUFFER_SIZE];
+  strncpy(tmpTime, time, TIME_BUFFER_SIZE);
+  uint16_t updates = pendingFIFO();
   uint16_t NumUpdates = _base.readData(EE_ADDR_NUMBER_UPDATES, INTERNAL); // Number of readings before batch update
-  if (updates >= (NumUpdates - 1) || instant) {
+  if ((updates >= (NumUpdates - 1) || instant) && _link.allow()) {
     if (sleep) {
 #if debugEnabled
       if (!_base.getDebugState()) Serial.println(F("SCK Waking up..."));
 #endif
       digitalWrite(AWAKE, HIGH);
     }
-    if (_base.connect()) {
+    if (join()) {
       //Wifi connect
 #if debugEnabled
       if (!_base.getDebugState()) Serial.println(F("SCK Connected to Wi-Fi!!"));
 #endif
+      boolean ok = false;
       if (update(value, time)) {
         //Update time and nets
 #if debugEnabled
@@ -288,27 +493,56 @@ void SCKServer::send(boolean sleep, boolean *wait_moment, long *value, char *tim
           Serial.println(updates + 1);
         }
 #endif
-        for (byte j = 0 ; j < HOSTS; j++) {
-          // post data to each host
-          int num_post = updates;
-          int cycles = cycles = updates / POST_MAX;;
-          if (updates > POST_MAX) {
-            for (int i = 0; i < cycles; i++) {
-              connect(j);
-              json_update(POST_MAX, value, tmpTime, false);
+        // Post as much as fits in the upload budget, the rest stays in memory for the next cycles
+        uint32_t budget = _base.readData(EE_ADDR_UPLOAD_BUDGET, INTERNAL);
+        _deadline = (budget > 0) ? millis() + budget * second : 0;
+        _byteBudget = _base.readData(EE_ADDR_UPLOAD_BYTES, INTERNAL);
+        _newestFirst = (_base.readData(EE_ADDR_UPLOAD_ORDER, INTERNAL) == UPLOAD_NEWEST);
+        _sent = 0;
+        boolean live = true;
+        uint16_t pending = updates;
+        while (live || ((pending > 0) && !budgetExceeded())) {
+          uint16_t chunk = pending;
+          if (chunk > POST_MAX) chunk = POST_MAX;
+          uint16_t posted = 0;
+          boolean taken = false;
+          for (byte j = 0 ; j < HOSTS; j++) {
+            // post the same records to each host, only the first one is cut by the budget.
+            // Host 0 is authoritative: the memory follows what it took, and records that
+            // host 1 missed are not sent to it again
+            seekFIFO();
+            _limited = (j == 0);
+            if (!connect(j)) continue;
+            ok = true;
+            if (j == 0) taken = true;
+            uint16_t count = json_update((j == 0) ? chunk : posted, value, tmpTime, live);
+            if (j == 0) posted = count;
+#if debugEnabled
+            if (!_base.getDebugState()) {
+              Serial.print(F("Posted to Server #"));
+              Serial.print(j);
+              Serial.println(F("!"));
             }
-            num_post = updates - cycles * POST_MAX;
+#endif
           }
-          connect(j);
-          json_update(num_post, value, tmpTime, true);
+          if (live && !taken) {
+            // Host 0 missed the live reading, it waits in memory for the next upload
+            addFIFO(value, tmpTime);
 #if debugEnabled
-          if (!_base.getDebugState()) {
-            Serial.print(F("Posted to Server #"));
-            Serial.print(j);
-            Serial.println(F("!"));
-          }
+            if (!_base.getDebugState()) Serial.println(F("Saved in memory!!"));
 #endif
+          }
+          live = false;
+          if (posted == 0) break;
+          commitFIFO(posted);
+          pending -= posted;
         }
+#if debugEnabled
+        if (!_base.getDebugState() && (pending > 0)) {
+          Serial.print(F("Upload budget reached, pending updates: "));
+          Serial.println(pending);
+        }
+#endif
       }
       else {
 #if debugEnabled
@@ -321,9 +555,10 @@ void SCKServer::send(boolean sleep, boolean *wait_moment, long *value, char *tim
       if (!_base.getDebugState()) Serial.println(F("Old connection active. Closing..."));
 #endif
       _base.close();
+      leave(ok);
     }
     else {
-      //No connect
+      //No connect, the connection manager holds the next tries back
       if (_base.checkRTC()) _base.RTCtime(time);
       else time = "#";
       addFIFO(value, time);
@@ -10,21 +10,42 @@
 #include <Arduino.h>
 #include "Constants.h"
 #include "SCKBase.h"
+#include "ConnectionManager.h"
 
 class SCKServer {
   public:
     SCKServer(SCKBase& base);
     boolean time(char *time);
-    void json_update(uint16_t updates, long *value, char *time, boolean isMultipart);
+    uint16_t json_update(uint16_t updates, long *value, char *time, boolean isMultipart);
     void send(boolean sleep, boolean *wait_moment, long *value, char *time, boolean instant);
     boolean update(long *value, char *time_);
+    void scan(long *value);
     boolean connect(byte webhost);
     void addFIFO(long *value, char *time);
-    void readFIFO();
+    uint16_t pendingFIFO();
+    boolean thinFIFO(uint16_t updates);
+    void seekFIFO();
+    size_t readFIFO();
+    void commitFIFO(uint16_t posted);
     boolean RTCupdate(char *time);
+    boolean join();
+    void leave(boolean ok);
+    ConnectionManager& link();
 
   private:
+    uint32_t stepFIFO(uint32_t eeaddress, int records);
+    void writeTime(uint32_t eeaddress, char *time);
+    size_t printAggregate(Print& port, uint32_t header);
+    boolean budgetExceeded();
     SCKBase& _base;
+    ConnectionManager _link;
+    long _cursor;                 // Next FIFO record to print
+    boolean _newestFirst;
+    boolean _limited;             // The running post may be cut by the upload budget
+    unsigned long _deadline;      // 0 = no time budget
+    uint32_t _byteBudget;         // 0 = no byte budget
+    uint32_t _sent;
+    unsigned long _scanAt;        // Last Wi-Fi scan, 0 = none yet
 
 };
 #endif
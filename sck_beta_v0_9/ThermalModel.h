@@ -0,0 +1,58 @@
+/*
+
+  ThermalModel.h
+  First order model of how much the kit heats its own temperature sensor.
+
+  - Heat input (mW) from the battery charger and the radio, worked out by the caller.
+  - Steady state rise of THERMAL_RTH per 100mW, reached through a lag of time constant tau.
+  - Fixed point: rise in 0.01C (Q8), lag step in Q12.
+
+*/
+
+#ifndef SmartCitizen_ThermalModel_h
+#define SmartCitizen_ThermalModel_h
+
+#include <Arduino.h>
+#include "Constants.h"
+
+#define THERMAL_Q         8
+#define THERMAL_STEP_Q    12
+
+class ThermalModel {
+  public:
+
+    // tau in seconds, 0 disables the model
+    void setup(uint16_t tau_)
+    {
+      tau = tau_;
+    }
+
+    // power held for the last dt ms
+    void update(uint16_t power, unsigned long dt)
+    {
+      if (tau == 0) {
+        rise = 0;
+        return;
+      }
+      if (power > THERMAL_POWER_MAX) power = THERMAL_POWER_MAX;
+      int32_t target = ((int32_t)power * THERMAL_RTH / 100) << THERMAL_Q;
+      uint32_t step = (1UL << THERMAL_STEP_Q);
+      if (dt < (uint32_t)tau * 1000) {
+        // dt / (tau x 1000) in Q12 is dt x 512 / (tau x 125), kept in 32 bits: past 2^23 ms
+        // (2.3 hours) dt is taken in whole seconds instead
+        if (dt < (1UL << 23)) step = (dt << (THERMAL_STEP_Q - 3)) / ((uint32_t)tau * 125);
+        else step = ((dt / 1000) << THERMAL_STEP_Q) / tau;
+      }
+      rise += ((target - rise) * (int32_t)step) >> THERMAL_STEP_Q;
+    }
+
+    // 0.01C
+    int16_t getRise()
+    {
+      return rise >> THERMAL_Q;
+    }
+
+    uint16_t tau;
+    int32_t rise;
+};
+#endif
@@ -0,0 +1,49 @@
+/*
+
+  Welford.h
+  Interval statistics of one channel: min, max, mean and standard deviation.
+
+  - Welford's running mean and sum of squared differences, one pass, no sample buffer.
+  - Cleared by the caller at the end of every upload interval.
+
+*/
+
+#ifndef SmartCitizen_Welford_h
+#define SmartCitizen_Welford_h
+
+#include <Arduino.h>
+
+class Welford {
+  public:
+
+    void clear()
+    {
+      count = 0;
+      mean = 0;
+      m2 = 0;
+    }
+
+    void add(long x)
+    {
+      if ((count == 0) || (x < minimum)) minimum = x;
+      if ((count == 0) || (x > maximum)) maximum = x;
+      count++;
+      float delta = (float)x - mean;
+      mean += delta / count;
+      m2 += delta * ((float)x - mean);
+    }
+
+    // Sample standard deviation, 0 with less than two samples
+    float stddev()
+    {
+      if (count < 2) return 0;
+      return sqrt(m2 / (count - 1));
+    }
+
+    uint16_t count;
+    long minimum;
+    long maximum;
+    float mean;
+    float m2;
+};
+#endif
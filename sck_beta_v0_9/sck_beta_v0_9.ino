@@ -22,6 +22,13 @@
     Constants.h             - Defines pins configuration and other static parameters.
     AccumulatorFilter.h     - Used for battery temperature decoupling in  Smart Citizen Kit v.1.0
     TemperatureDecoupler.h  - Used for battery temperature decoupling in  Smart Citizen Kit v.1.0
+    ConnectionManager.h     - Backoff, radio budget and circuit breaker for the Wi-Fi connections.
+    EventDetector.h         - Detects readings that must be posted without waiting for the batch.
+    NoiseMeter.h            - Leq, Lmax, L10 and L90 of the microphone, fed from the ADC interrupt.
+    OctaveBands.h           - Fixed point FFT of a burst of microphone samples into octave bands.
+    HeaterLoop.h            - PI control of the MICS heater currents.
+    Welford.h               - Min, max, mean and stddev of a channel over an upload interval.
+    ThermalModel.h          - Self heating of the kit, removed from the temperature.
 
   Check REAMDE.md for more information.
 
@@ -42,7 +49,6 @@ void setup()
 {
   ambient.begin();
   ambient.ini();
-  ambient.execute(true);
 }
 
 void loop()